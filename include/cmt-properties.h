@@ -45,5 +45,60 @@
 #define CMT_PROP_SCROLL_AXES "Scroll Axes"
 #define CMT_PROP_DUMP_DEBUG_LOG "Dump Debug Log"
 #define CMT_PROP_RAW_TOUCH_PASSTHROUGH "Raw Touch Passthrough"
+#define CMT_PROP_METRICS_VALUATORS "Metrics Valuators"
+#define CMT_PROP_GESTURE_STREAM "Gesture Stream"
+/* Time frames with MSC_TIMESTAMP when the device reports it */
+#define CMT_PROP_HW_TIMESTAMPS "Hardware Timestamps"
+/* Keep the device open while it is disabled */
+#define CMT_PROP_WARM_RESUME "Warm Resume"
+/* Keyboard class, by default only with keys below BTN_MISC; read only */
+#define CMT_PROP_KEYBOARD "Keyboard"
+/* Apply the non-linearity correction in the driver instead of the library */
+#define CMT_PROP_LINEARITY_CORRECTION "Driver Linearity Correction"
+/* Run the gestures interpreter on a direct touch device */
+#define CMT_PROP_TOUCHSCREEN_GESTURES "Touchscreen Gestures"
+/* Set to hold back set handlers, clear to run each held back one once */
+#define CMT_PROP_PROPERTY_BATCH "Property Batch"
+/* Set to publish every lazy property, clear to withdraw them again */
+#define CMT_PROP_PUBLISH_LAZY "Publish Lazy Properties"
+/* Set to apply the InputClass options of Config Directories again */
+#define CMT_PROP_RELOAD_CONFIG "Reload Config"
+/* Measure the report rate and derive "Accel Min dt" from it */
+#define CMT_PROP_DETECT_RATE "Detect Report Rate"
+/* Keep "Input Queue Delay" as short as the frame arrival jitter allows */
+#define CMT_PROP_ADAPTIVE_QUEUE "Adaptive Input Queue Delay"
+
+/* Bool, read only */
+#define CMT_PROP_LEAN_EVENTS "Lean Events"
+#define CMT_PROP_DIRECT_TOUCH "Direct Touch"
+#define CMT_PROP_LAZY_PROPERTIES "Lazy Properties"
+
+/* String */
+#define CMT_PROP_CONFIG_DIRS "Config Directories"  /* ':' separated */
+
+/* String, read only */
+#define CMT_PROP_GESTURE_STREAM_DIR "Gesture Stream Directory"
+#define CMT_PROP_GESTURE_STREAM_LOCATION "Gesture Stream Location"
+
+/* Float[2], read only: kernel and frame time jitter, ms */
+#define CMT_PROP_FRAME_JITTER "Frame Time Jitter"
+
+/* Float, s: bounds of Adaptive Input Queue Delay */
+#define CMT_PROP_QUEUE_MIN_DELAY "Adaptive Queue Min Delay"
+#define CMT_PROP_QUEUE_MAX_DELAY "Adaptive Queue Max Delay"
+
+/* 32 bit: sequence number after the last Metrics Buffer record handled */
+#define CMT_PROP_METRICS_ACK "Metrics Ack"
+
+/* 32 bit, read only */
+#define CMT_PROP_RELOAD_CHANGES "Reload Config Changes"
+#define CMT_PROP_QUEUE_CORRECTIONS "Adaptive Queue Corrections"
+
+/* Float, read only */
+#define CMT_PROP_METRICS_BUFFER "Metrics Buffer"
+#define CMT_PROP_PROPERTY_BATCH_TIME "Property Batch Apply Time"  /* ms */
+#define CMT_PROP_REPORT_RATE "Report Rate"  /* Hz, 0 until measured */
+#define CMT_PROP_REPORT_JITTER "Report Interval Jitter"  /* ms */
+#define CMT_PROP_QUEUE_CURRENT "Adaptive Queue Delay"  /* s */
 
 #endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _BOARD_TABLE_H_
+#define _BOARD_TABLE_H_
+
+#include <stddef.h>
+
+/*
+ * Option defaults compiled from the InputClass sections of xorg-conf by
+ * xorg-conf/gen-board-table.awk. Values are parsed at build time.
+ */
+
+typedef enum {
+    BOARD_VALUE_STRING,
+    BOARD_VALUE_BOOL,
+    BOARD_VALUE_INT,
+    BOARD_VALUE_REAL
+} BoardValueType;
+
+typedef struct {
+    const char* name;
+    const char* value;
+    BoardValueType type;
+    double number;  /* Parsed value, unless type is BOARD_VALUE_STRING */
+} BoardOption;
+
+/* Device kinds a section is limited to */
+#define BOARD_MATCH_POINTER     (1 << 0)
+#define BOARD_MATCH_TOUCHPAD    (1 << 1)
+#define BOARD_MATCH_TOUCHSCREEN (1 << 2)
+
+typedef struct {
+    const char* board;          /* "" for every board */
+    const char* identifier;
+    unsigned match_type;        /* BOARD_MATCH_* the device must all have */
+    unsigned match_not_type;    /* BOARD_MATCH_* the device must not have */
+    const char* match_product;  /* '|' separated substrings of the name */
+    const char* match_usbid;    /* '|' separated "vvvv:pppp" patterns */
+    const char* match_path;     /* '|' separated device path patterns */
+    const BoardOption* options;
+    size_t num_options;
+} BoardSection;
+
+extern const BoardSection board_sections[];
+extern const size_t board_num_sections;
+
+#endif
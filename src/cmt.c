@@ -12,6 +12,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <exevents.h>
@@ -22,6 +23,7 @@
 #include <xkbsrv.h>
 #include <xserver-properties.h>
 
+#include "cmt-properties.h"
 #include "properties.h"
 
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) < 12
@@ -46,6 +48,8 @@
 
 #define AXIS_LABEL_PROP_ABS_TOUCH_TIMESTAMP "Touch Timestamp"
 
+#define AXIS_LABEL_PROP_ABS_PEN_PRESSURE "Abs Pen Pressure"
+
 /**
  * Forward declarations
  */
@@ -64,6 +68,11 @@ static Bool DeviceOff(DeviceIntPtr);
 static Bool DeviceClose(DeviceIntPtr);
 
 static Bool OpenDevice(InputInfoPtr);
+static void DrainDevice(InputInfoPtr);
+static void DetectPen(CmtDevicePtr);
+static void OpenLinearity(InputInfoPtr);
+static Bool HasKeyboardKeys(CmtDevicePtr);
+static void InitializeKeyboard(DeviceIntPtr);
 static int InitializeXDevice(DeviceIntPtr dev);
 
 static void libevdev_log_x(void* udata, int level, const char* format, ...)
@@ -148,25 +157,55 @@ PreInit(InputDriverPtr drv, InputInfoPtr info, int flags)
         goto Error_Event_Init;
     }
 
-    // The cmt driver currently powers mice, multi-touch mice and touchpads.
-    // We list mice as XI_MOUSE and the others as XI_TOUCHPAD.
+    // Touchscreens default to direct touch mode, which sends touches straight
+    // to clients and does not need a gestures interpreter.
+    if (cmt->evdev.info.evdev_class == EvdevClassTouchscreen)
+      cmt->props.direct_touch = xf86SetBoolOption(info->options,
+                                                  CMT_PROP_DIRECT_TOUCH, TRUE);
+
+    // Direct touch devices get an interpreter only when gestures are
+    // enabled for them, now or later through the property.
+    if (cmt->props.direct_touch)
+      cmt->props.touchscreen_gestures =
+          xf86SetBoolOption(info->options, CMT_PROP_TOUCHSCREEN_GESTURES,
+                            FALSE);
+
+    // Pens get their own path, which posts absolute motion and so needs the
+    // absolute axes of direct touch mode.
+    if (cmt->props.direct_touch)
+      DetectPen(cmt);
+
+    // The cmt driver currently powers mice, multi-touch mice, touchpads and
+    // touchscreens. We list mice as XI_MOUSE, touchscreens in direct touch
+    // mode as XI_TOUCHSCREEN and the others as XI_TOUCHPAD.
     if (cmt->evdev.info.evdev_class == EvdevClassMouse)
       info->type_name = (char*)XI_MOUSE;
+    else if (cmt->props.direct_touch)
+      info->type_name = (char*)XI_TOUCHSCREEN;
     else
       info->type_name = (char*)XI_TOUCHPAD;
 
     xf86ProcessCommonOptions(info, info->options);
 
+    // The correction options can come from the board defaults
+    if (PropertiesIndexOptions(info) != Success)
+        ERR(info, "Failed to index options\n");
+    OpenLinearity(info);
+
     if (info->fd >= 0)
         info->fd = EvdevClose(&cmt->evdev);
 
-    rc = Gesture_Init(&cmt->gesture, Event_Get_Slot_Count(&cmt->evdev));
+    rc = Gesture_Init(&cmt->gesture, Event_Get_Slot_Count(&cmt->evdev),
+                      !cmt->props.direct_touch ||
+                      cmt->props.touchscreen_gestures);
     if (rc != Success)
         goto Error_Gesture_Init;
 
     return Success;
 
 Error_Gesture_Init:
+    Linearity_Close(cmt->linearity);
+    OptionIndex_Free(&cmt->option_index);
     Event_Free(&cmt->evdev);
 Error_Event_Init:
     if (info->fd >= 0)
@@ -177,6 +216,62 @@ Error_OpenDevice:
     return rc;
 }
 
+/*
+ * Look for pen tools reported through the MT slots or as a single touch
+ * BTN_TOOL_PEN, and for tilt axes.
+ */
+static void
+DetectPen(CmtDevicePtr cmt)
+{
+    EvdevPtr evdev = &cmt->evdev;
+
+    cmt->has_pen =
+        TestBit(ABS_MT_TOOL_TYPE, evdev->info.abs_bitmask) &&
+        evdev->info.absinfo[ABS_MT_TOOL_TYPE].maximum >= MT_TOOL_PEN;
+    /* MT pens also emulate BTN_TOOL_PEN, which must not post them twice */
+    cmt->has_st_pen = !cmt->has_pen &&
+                      TestBit(BTN_TOOL_PEN, evdev->info.key_bitmask) &&
+                      TestBit(ABS_X, evdev->info.abs_bitmask) &&
+                      TestBit(ABS_Y, evdev->info.abs_bitmask);
+    cmt->has_tilt = TestBit(ABS_TILT_X, evdev->info.abs_bitmask) &&
+                    TestBit(ABS_TILT_Y, evdev->info.abs_bitmask);
+}
+
+/*
+ * Check the non-linearity correction data now, so a bad file shows up in
+ * the log of the device that names it. Correction is turned off for such a
+ * device. Otherwise the driver applies it, unless configured not to, and
+ * the library stage is turned off so it is not applied twice.
+ */
+static void
+OpenLinearity(InputInfoPtr info)
+{
+    CmtDevicePtr cmt = info->private;
+    OptionIndexPtr index = &cmt->option_index;
+    char* path;
+
+    if (!OptionIndex_Bool(index, info->options, LINEARITY_OPT_ENABLE, FALSE))
+        return;
+    path = OptionIndex_Str(index, info->options, LINEARITY_OPT_FILE, NULL);
+    if (!path)
+        return;
+
+    cmt->linearity = Linearity_Open(info, path);
+    if (!cmt->linearity) {
+        ERR(info, "Disabling non-linearity correction\n");
+        OptionIndex_Replace_Bool(index, &info->options, LINEARITY_OPT_ENABLE,
+                                 FALSE);
+    } else if (OptionIndex_Bool(index, info->options,
+                                CMT_PROP_LINEARITY_CORRECTION, TRUE)) {
+        OptionIndex_Replace_Bool(index, &info->options, LINEARITY_OPT_ENABLE,
+                                 FALSE);
+    } else {
+        Linearity_Close(cmt->linearity);
+        cmt->linearity = NULL;
+    }
+    free(path);
+}
+
 static void
 UnInit(InputDriverPtr drv, InputInfoPtr info, int flags)
 {
@@ -190,6 +285,8 @@ UnInit(InputDriverPtr drv, InputInfoPtr info, int flags)
 
     if (cmt) {
         Gesture_Free(&cmt->gesture);
+        Linearity_Close(cmt->linearity);
+        OptionIndex_Free(&cmt->option_index);
         free(cmt->device);
         cmt->device = NULL;
         Event_Free(&cmt->evdev);
@@ -228,6 +325,20 @@ ReadInput(InputInfoPtr info)
     CmtDevicePtr cmt = info->private;
 
     int err = EvdevRead(&cmt->evdev);
+    struct timespec now;
+    unsigned us;
+
+    if (err == Success && cmt->resume_pending) {
+        cmt->resume_pending = FALSE;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        us = (now.tv_sec - cmt->resume_start.tv_sec) * 1000000 +
+             (now.tv_nsec - cmt->resume_start.tv_nsec) / 1000;
+        /* Runs in the input thread, so only the signal safe logger */
+        LogMessageVerbSigSafe(X_INFO, 0,
+                              "%s: first events %u us after %s resume\n",
+                              info->name, us, cmt->warm ? "warm" : "cold");
+        cmt->warm = FALSE;
+    }
     if (err != Success) {
       if (err == ENODEV) {
           xf86RemoveEnabledDevice(info);
@@ -258,6 +369,7 @@ DeviceInit(DeviceIntPtr dev)
         return rc;
 
     Gesture_Device_Init(&cmt->gesture, dev);
+    PropertiesPublish(dev);
 
     return Success;
 }
@@ -271,6 +383,17 @@ DeviceOn(DeviceIntPtr dev)
 
     DBG(info, "DeviceOn\n");
 
+    clock_gettime(CLOCK_MONOTONIC, &cmt->resume_start);
+    cmt->resume_pending = TRUE;
+
+    /*
+     * A warm fd is still open: drop what queued up while off instead of
+     * reopening it. Either way Event_Open resyncs slot and key state.
+     */
+    if (cmt->warm && info->fd >= 0)
+        DrainDevice(info);
+    else
+        cmt->warm = FALSE;
     rc = OpenDevice(info);
     if (rc != Success)
         return rc;
@@ -279,6 +402,7 @@ DeviceOn(DeviceIntPtr dev)
     xf86AddEnabledDevice(info);
     dev->public.on = TRUE;
     Gesture_Device_On(&cmt->gesture);
+    PropertiesDeviceOn(dev);
     return Success;
 }
 
@@ -291,10 +415,18 @@ DeviceOff(DeviceIntPtr dev)
     DBG(info, "DeviceOff\n");
 
     dev->public.on = FALSE;
+    PropertiesDeviceOff(dev);
     Gesture_Device_Off(&cmt->gesture);
     if (info->fd != -1) {
         xf86RemoveEnabledDevice(info);
-        info->fd = EvdevClose(&cmt->evdev);
+        /* Server managed fds are paused and replaced by the server */
+        cmt->warm = cmt->props.warm_resume;
+#ifdef XI86_SERVER_FD
+        if (info->flags & XI86_SERVER_FD)
+            cmt->warm = FALSE;
+#endif
+        if (!cmt->warm)
+            info->fd = EvdevClose(&cmt->evdev);
     }
     return Success;
 }
@@ -308,6 +440,9 @@ DeviceClose(DeviceIntPtr dev)
     DBG(info, "DeviceClose\n");
 
     DeviceOff(dev);
+    if (info->fd != -1)
+        info->fd = EvdevClose(&cmt->evdev);
+    cmt->warm = FALSE;
     Gesture_Device_Close(&cmt->gesture);
     PropertiesClose(dev);
     return Success;
@@ -345,6 +480,18 @@ OpenDevice(InputInfoPtr info)
 }
 
 
+/*
+ * Discard the events a warm fd queued while the device was off.
+ */
+static void
+DrainDevice(InputInfoPtr info)
+{
+    struct input_event ev[64];
+
+    while (read(info->fd, ev, sizeof(ev)) > 0)
+        continue;
+}
+
 /**
  * Setup X Input Device Classes
  */
@@ -372,6 +519,69 @@ InitAtom(const char* name)
     return atom;
 }
 
+/*
+ * Whether the given CMT_AXIS is registered with the server. Lean event mode
+ * keeps only the pointer motion and scroll axes, direct touch mode only the
+ * touch axes. Otherwise the axes follow what the device can produce: plain
+ * mice get no touch, fling, swipe or metrics axes, and only devices with MT
+ * positions get the touch axes.
+ */
+static Bool
+AxisEnabled(CmtDevicePtr cmt, int axis)
+{
+    /* Pens are posted directly, which only direct touch devices do. */
+    if (axis == CMT_AXIS_PEN_PRESSURE)
+        return cmt->has_pen ||
+               (cmt->has_st_pen &&
+                TestBit(ABS_PRESSURE, cmt->evdev.info.abs_bitmask));
+    if (axis == CMT_AXIS_PEN_TILT_X || axis == CMT_AXIS_PEN_TILT_Y)
+        return (cmt->has_pen || cmt->has_st_pen) && cmt->has_tilt;
+
+    /*
+     * Direct touch devices only send touches, which need no gesture axes.
+     * With gestures configured, they also get the scroll axes.
+     */
+    if (cmt->props.direct_touch)
+        return axis == CMT_AXIS_X || axis == CMT_AXIS_Y ||
+               axis >= CMT_AXIS_MT_POSITION_X ||
+               (cmt->props.touchscreen_gestures &&
+                (axis == CMT_AXIS_SCROLL_X || axis == CMT_AXIS_SCROLL_Y));
+
+    if (cmt->evdev.info.evdev_class == EvdevClassMouse) {
+        switch (axis) {
+        case CMT_AXIS_X:
+        case CMT_AXIS_Y:
+        case CMT_AXIS_ORDINAL_X:
+        case CMT_AXIS_ORDINAL_Y:
+        case CMT_AXIS_SCROLL_X:
+        case CMT_AXIS_SCROLL_Y:
+        case CMT_AXIS_DBL_START_TIME:
+        case CMT_AXIS_DBL_END_TIME:
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    /* Raw touch passthrough needs positions from the MT slots */
+    if (axis >= CMT_AXIS_MT_POSITION_X && axis <= CMT_AXIS_TOUCH_TIMESTAMP &&
+        !TestBit(ABS_MT_POSITION_X, cmt->evdev.info.abs_bitmask))
+        return FALSE;
+
+    if (!cmt->props.lean_events)
+        return TRUE;
+
+    switch (axis) {
+    case CMT_AXIS_X:
+    case CMT_AXIS_Y:
+    case CMT_AXIS_SCROLL_X:
+    case CMT_AXIS_SCROLL_Y:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
 static int
 InitializeXDevice(DeviceIntPtr dev)
 {
@@ -396,6 +606,9 @@ InitializeXDevice(DeviceIntPtr dev)
         AXIS_LABEL_PROP_ABS_MT_PRESSURE,
         AXIS_LABEL_PROP_ABS_MT_TOUCH_MAJOR,
         AXIS_LABEL_PROP_ABS_TOUCH_TIMESTAMP,
+        AXIS_LABEL_PROP_ABS_PEN_PRESSURE,
+        AXIS_LABEL_PROP_ABS_TILT_X,
+        AXIS_LABEL_PROP_ABS_TILT_Y,
     };
     static const char* btn_names[CMT_NUM_BUTTONS] = {
         BTN_LABEL_PROP_BTN_LEFT,
@@ -407,7 +620,6 @@ InitializeXDevice(DeviceIntPtr dev)
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
 
-    XkbRMLVOSet rmlvo = { 0 };
     Atom axes_labels[CMT_NUM_AXES] = { 0 };
     Atom btn_labels[CMT_NUM_BUTTONS] = { 0 };
     /* Map our button numbers to standard ones. */
@@ -421,12 +633,39 @@ InitializeXDevice(DeviceIntPtr dev)
     };
     int i;
 
+    /* The axis set is fixed once registered, so read the option here. */
+    if (!cmt->props.direct_touch)
+        cmt->props.lean_events = xf86SetBoolOption(info->options,
+                                                   CMT_PROP_LEAN_EVENTS, FALSE);
+
+    /*
+     * Compiling a keymap is one of the costlier steps of device setup, so
+     * only devices with keyboard keys get the keyboard class by default.
+     */
+    cmt->props.keyboard = xf86SetBoolOption(info->options, CMT_PROP_KEYBOARD,
+                                            HasKeyboardKeys(cmt));
+
     /* TODO: Prop to adjust button mapping */
     for (i = 0; i < CMT_NUM_BUTTONS; i++)
         btn_labels[i] = XIGetKnownProperty(btn_names[i]);
 
-    for (i = 0; i < CMT_NUM_AXES; i++)
-        axes_labels[i] = InitAtom(axes_names[i]);
+    /* Assign valuator numbers to the axes this device registers. */
+    cmt->num_axes = 0;
+    for (i = 0; i < CMT_NUM_AXES; i++) {
+        if (!AxisEnabled(cmt, i)) {
+            cmt->axis_map[i] = -1;
+            continue;
+        }
+        cmt->axis_map[i] = cmt->num_axes;
+        if (cmt->props.direct_touch && i == CMT_AXIS_X)
+            axes_labels[cmt->num_axes++] = InitAtom(AXIS_LABEL_PROP_ABS_X);
+        else if (cmt->props.direct_touch && i == CMT_AXIS_Y)
+            axes_labels[cmt->num_axes++] = InitAtom(AXIS_LABEL_PROP_ABS_Y);
+        else
+            axes_labels[cmt->num_axes++] = InitAtom(axes_names[i]);
+    }
+    xf86IDrvMsg(info, X_INFO, "Registering %d of %d valuators\n",
+                cmt->num_axes, CMT_NUM_AXES);
 
     /* initialize mouse emulation valuators */
     InitPointerDeviceStruct((DevicePtr)dev,
@@ -434,26 +673,55 @@ InitializeXDevice(DeviceIntPtr dev)
                             CMT_NUM_BUTTONS, btn_labels,
                             PointerCtrl,
                             GetMotionHistorySize(),
-                            CMT_NUM_AXES, axes_labels);
+                            cmt->num_axes, axes_labels);
 
     for (i = 0; i < CMT_NUM_AXES; i++) {
         int mode = (i == CMT_AXIS_X || i == CMT_AXIS_Y) ? Relative : Absolute;
+        int axis = cmt->axis_map[i];
         if (i >= CMT_AXIS_MT_POSITION_X)
             break;
-        xf86InitValuatorAxisStruct(
-            dev, i, axes_labels[i], -1, -1, 1, 0, 1, mode);
-        xf86InitValuatorDefaults(dev, i);
+        if (axis < 0)
+            continue;
+        if (cmt->props.direct_touch) {
+            /*
+             * Touch positions are posted on X/Y as absolute values, which
+             * the server scales from the device range to the screen.
+             */
+            int input_axis = (i == CMT_AXIS_X) ? ABS_MT_POSITION_X :
+                                                 ABS_MT_POSITION_Y;
+            /* Single touch pens without MT axes scale their own range */
+            if (!TestBit(ABS_MT_POSITION_X, cmt->evdev.info.abs_bitmask))
+                input_axis = (i == CMT_AXIS_X) ? ABS_X : ABS_Y;
+            xf86InitValuatorAxisStruct(
+                dev, axis, axes_labels[axis],
+                cmt->evdev.info.absinfo[input_axis].minimum,
+                cmt->evdev.info.absinfo[input_axis].maximum,
+                cmt->evdev.info.absinfo[input_axis].resolution,
+                0,
+                cmt->evdev.info.absinfo[input_axis].resolution,
+                Absolute);
+        } else {
+            xf86InitValuatorAxisStruct(
+                dev, axis, axes_labels[axis], -1, -1, 1, 0, 1, mode);
+        }
+        xf86InitValuatorDefaults(dev, axis);
     }
 
     /* initialize raw touch valuators */
-    InitTouchClassDeviceStruct(dev, Event_Get_Slot_Count(&cmt->evdev),
-                               XIDependentTouch, CMT_NUM_MT_AXES);
+    if (cmt->axis_map[CMT_AXIS_MT_POSITION_X] >= 0)
+        InitTouchClassDeviceStruct(dev, Event_Get_Slot_Count(&cmt->evdev),
+                                   cmt->props.direct_touch ? XIDirectTouch :
+                                                             XIDependentTouch,
+                                   CMT_NUM_MT_AXES);
 
     for (i = 0; i < CMT_NUM_AXES; i++) {
         int mode = (i == CMT_AXIS_X || i == CMT_AXIS_Y) ? Relative : Absolute;
+        int axis = cmt->axis_map[i];
         int input_axis = 0;
+        if (axis < 0)
+            continue;
         if (i == CMT_AXIS_TOUCH_TIMESTAMP) {
-            xf86InitValuatorAxisStruct(dev, i, axes_labels[i],
+            xf86InitValuatorAxisStruct(dev, axis, axes_labels[axis],
                 0, INT_MAX, 1, 0, 1, Absolute);
             continue;
         }
@@ -466,24 +734,63 @@ InitializeXDevice(DeviceIntPtr dev)
             input_axis = ABS_MT_PRESSURE;
         else if (i == CMT_AXIS_MT_TOUCH_MAJOR)
             input_axis = ABS_MT_TOUCH_MAJOR;
+        else if (i == CMT_AXIS_PEN_PRESSURE)
+            input_axis = cmt->has_pen ? ABS_MT_PRESSURE : ABS_PRESSURE;
+        else if (i == CMT_AXIS_PEN_TILT_X)
+            input_axis = ABS_TILT_X;
+        else if (i == CMT_AXIS_PEN_TILT_Y)
+            input_axis = ABS_TILT_Y;
         else
             continue;
         xf86InitValuatorAxisStruct(
-                dev, i, axes_labels[i],
+                dev, axis, axes_labels[axis],
                 cmt->evdev.info.absinfo[input_axis].minimum,
                 cmt->evdev.info.absinfo[input_axis].maximum,
                 cmt->evdev.info.absinfo[input_axis].resolution,
                 0,
                 cmt->evdev.info.absinfo[input_axis].resolution,
                 mode);
-        xf86InitValuatorDefaults(dev, i);
+        xf86InitValuatorDefaults(dev, axis);
     }
 
     /* Inititialize the Scroll Valuators */
-    SetScrollValuator(dev, CMT_AXIS_SCROLL_X, SCROLL_TYPE_HORIZONTAL,
-		      1.0, 0);
-    SetScrollValuator(dev, CMT_AXIS_SCROLL_Y, SCROLL_TYPE_VERTICAL,
-                      1.0, 0);
+    if (cmt->axis_map[CMT_AXIS_SCROLL_X] >= 0)
+        SetScrollValuator(dev, cmt->axis_map[CMT_AXIS_SCROLL_X],
+                          SCROLL_TYPE_HORIZONTAL, 1.0, 0);
+    if (cmt->axis_map[CMT_AXIS_SCROLL_Y] >= 0)
+        SetScrollValuator(dev, cmt->axis_map[CMT_AXIS_SCROLL_Y],
+                          SCROLL_TYPE_VERTICAL, 1.0, 0);
+
+    if (cmt->props.keyboard)
+        InitializeKeyboard(dev);
+    else
+        xf86IDrvMsg(info, X_INFO, "No keyboard keys, no keyboard class\n");
+
+    return Success;
+}
+
+/*
+ * Whether the device reports any key below the button range.
+ */
+static Bool
+HasKeyboardKeys(CmtDevicePtr cmt)
+{
+    int i;
+
+    for (i = KEY_ESC; i < BTN_MISC; i++)
+        if (TestBit(i, cmt->evdev.info.key_bitmask))
+            return TRUE;
+    return FALSE;
+}
+
+static void
+InitializeKeyboard(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    XkbRMLVOSet rmlvo = { 0 };
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     /* Initialize keyboard device struct. Based on xf86-input-evdev,
        do not allow any rule/layout/etc changes. */
@@ -497,7 +804,10 @@ InitializeXDevice(DeviceIntPtr dev)
     InitKeyboardDeviceStruct(dev, &rmlvo, NULL, KeyboardCtrl);
     XkbFreeRMLVOSet(&rmlvo, FALSE);
 
-    return Success;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    xf86IDrvMsg(info, X_INFO, "Keyboard class set up in %.2f ms\n",
+                (end.tv_sec - start.tv_sec) * 1e3 +
+                (end.tv_nsec - start.tv_nsec) / 1e6);
 }
 
 
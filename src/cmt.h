@@ -7,10 +7,13 @@
 #ifndef _CMT_H_
 #define _CMT_H_
 
+#include <time.h>
 #include <linux/input.h>
 
 #include <gesture.h>
 #include <properties.h>
+#include <options.h>
+#include <linearity.h>
 // todo(denniskempin): allow libevdev to be included before X headers
 #include <libevdevc/libevdevc.h>
 
@@ -35,6 +38,12 @@
 /* Number of longs needed to hold the given number of bits */
 #define NLONGS(x) (((x) + LONG_BITS - 1) / LONG_BITS)
 
+/* Implementation of inline bit operations */
+static inline bool TestBit(int bit, const unsigned long* array)
+{
+    return !!(array[bit / LONG_BITS] & (1L << (bit % LONG_BITS)));
+}
+
 /* Axes numbers. */
 enum CMT_AXIS {
     CMT_AXIS_X = 0,
@@ -56,10 +65,13 @@ enum CMT_AXIS {
     CMT_AXIS_MT_POSITION_Y,
     CMT_AXIS_MT_PRESSURE,
     CMT_AXIS_MT_TOUCH_MAJOR,
-    CMT_AXIS_TOUCH_TIMESTAMP
+    CMT_AXIS_TOUCH_TIMESTAMP,
+    CMT_AXIS_PEN_PRESSURE,
+    CMT_AXIS_PEN_TILT_X,
+    CMT_AXIS_PEN_TILT_Y
 };
 
-#define CMT_NUM_AXES (CMT_AXIS_TOUCH_TIMESTAMP - CMT_AXIS_X + 1)
+#define CMT_NUM_AXES (CMT_AXIS_PEN_TILT_Y - CMT_AXIS_X + 1)
 #define CMT_NUM_MT_AXES (CMT_AXIS_TOUCH_TIMESTAMP - CMT_AXIS_MT_POSITION_X + 1)
 
 /* Button numbers. */
@@ -78,11 +90,33 @@ typedef struct {
     EventStateRec evstate;
     GestureRec gesture;
     GesturesProp* prop_list;
+    GesturesProp** prop_index;  /* Hash table of prop_list, keyed by atom */
+    size_t prop_index_size;
+    size_t prop_count;
+    Bool prop_deferred;    /* New properties wait for PropertiesPublish */
+    Bool prop_publishing;  /* Ignore our own XIChangeDeviceProperty calls */
+    Bool prop_pin;         /* New properties are never lazy */
+    OptionIndexRec option_index;  /* Options, until DeviceClose */
     Evdev evdev;
 
     char* device;
     long  handlers;
-    unsigned long prev_key_state[NLONGS(KEY_CNT)];
+
+    /* Pen tools: MT slots with MT_TOOL_PEN, or a single touch BTN_TOOL_PEN */
+    Bool has_pen;
+    Bool has_st_pen;
+    Bool has_tilt;
+
+    /* Valuator number of each CMT_AXIS, or -1 if it is not registered */
+    int axis_map[CMT_NUM_AXES];
+    int num_axes;
+
+    LinearityPtr linearity;  /* Non-linearity correction data, or NULL */
+
+    /* Warm resume: the fd stays open while the device is off */
+    Bool warm;               /* The fd was kept open by DeviceOff */
+    Bool resume_pending;     /* No events read since DeviceOn */
+    struct timespec resume_start;
 } CmtDeviceRec, *CmtDevicePtr;
 
 #endif
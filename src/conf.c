@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "conf.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONF_LINE_LEN 1024
+#define CONF_MAX_ARGS 2
+
+static int Conf_Load_File(ConfPtr, const char*);
+static int Conf_Filter(const struct dirent*);
+
+void
+Conf_Init(ConfPtr conf)
+{
+    conf->sections = NULL;
+    conf->num_sections = 0;
+}
+
+static void
+Conf_Free_Section(BoardSection* section)
+{
+    size_t i;
+
+    for (i = 0; i < section->num_options; i++) {
+        free((char*)section->options[i].name);
+        free((char*)section->options[i].value);
+    }
+    free((BoardOption*)section->options);
+    free((char*)section->board);
+    free((char*)section->identifier);
+    free((char*)section->match_product);
+    free((char*)section->match_usbid);
+    free((char*)section->match_path);
+    memset(section, 0, sizeof(*section));
+}
+
+void
+Conf_Free(ConfPtr conf)
+{
+    size_t i;
+
+    for (i = 0; i < conf->num_sections; i++)
+        Conf_Free_Section(&conf->sections[i]);
+    free(conf->sections);
+    Conf_Init(conf);
+}
+
+/*
+ * Split a line into its keyword and up to CONF_MAX_ARGS quoted arguments.
+ * Returns the number of arguments, or -1 for blank and comment lines.
+ */
+static int
+Conf_Split(char* line, char** keyword, char** args)
+{
+    char* p = line;
+    char* end;
+    int n = 0;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    if (!*p || *p == '#')
+        return -1;
+
+    *keyword = p;
+    while (*p && !isspace((unsigned char)*p))
+        p++;
+    if (*p)
+        *p++ = '\0';
+
+    while (n < CONF_MAX_ARGS && (p = strchr(p, '"'))) {
+        end = strchr(p + 1, '"');
+        if (!end)
+            break;
+        *end = '\0';
+        args[n++] = p + 1;
+        p = end + 1;
+    }
+
+    return n;
+}
+
+/*
+ * Limit a section to devices of a kind, or, with a false value, to those
+ * not of that kind, as MatchIs* does. Returns FALSE for a value that is
+ * not a boolean.
+ */
+static Bool
+Conf_Match_Type(BoardSection* section, const char* value, unsigned type)
+{
+    Bool on;
+
+    if (!xf86getBoolValue(&on, value))
+        return FALSE;
+    if (on)
+        section->match_type |= type;
+    else
+        section->match_not_type |= type;
+    return TRUE;
+}
+
+static int
+Conf_Add_Option(BoardSection* section, const char* name, const char* value)
+{
+    BoardOption* options;
+    BoardOption* option;
+
+    options = realloc((BoardOption*)section->options,
+                      (section->num_options + 1) * sizeof(*options));
+    if (!options)
+        return ENOMEM;
+    section->options = options;
+
+    option = &options[section->num_options];
+    option->name = strdup(name);
+    option->value = strdup(value);
+    option->type = BOARD_VALUE_STRING;
+    option->number = 0;
+    if (!option->name || !option->value) {
+        free((char*)option->name);
+        free((char*)option->value);
+        return ENOMEM;
+    }
+    section->num_options++;
+
+    return Success;
+}
+
+/*
+ * Keep a finished section, unless it sets nothing or never applies to a
+ * cmt device.
+ */
+static int
+Conf_Add_Section(ConfPtr conf, BoardSection* section, Bool skip)
+{
+    BoardSection* sections;
+
+    if (!section->num_options || skip) {
+        Conf_Free_Section(section);
+        return Success;
+    }
+
+    sections = realloc(conf->sections,
+                       (conf->num_sections + 1) * sizeof(*sections));
+    if (!sections) {
+        Conf_Free_Section(section);
+        return ENOMEM;
+    }
+    conf->sections = sections;
+    conf->sections[conf->num_sections++] = *section;
+    memset(section, 0, sizeof(*section));
+
+    return Success;
+}
+
+/*
+ * Read the InputClass sections of one file. Every file on disk is in use,
+ * so its sections apply to every board. Sections for other drivers, and
+ * those with match keywords or values BoardSection cannot express, are
+ * left out: they are taken not to match.
+ */
+static int
+Conf_Load_File(ConfPtr conf, const char* path)
+{
+    char line[CONF_LINE_LEN];
+    char* keyword;
+    char* args[CONF_MAX_ARGS];
+    BoardSection section;
+    Bool in_section = FALSE;
+    Bool skip = FALSE;
+    const char** field;
+    unsigned type;
+    FILE* fp;
+    int rc = Success;
+    int n;
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return errno;
+
+    memset(&section, 0, sizeof(section));
+    while (rc == Success && fgets(line, sizeof(line), fp)) {
+        n = Conf_Split(line, &keyword, args);
+        if (n < 0)
+            continue;
+
+        if (!strcmp(keyword, "Section")) {
+            Conf_Free_Section(&section);
+            in_section = n >= 1 && !strcmp(args[0], "InputClass");
+            if (in_section) {
+                skip = FALSE;
+                section.board = strdup("");
+                if (!section.board)
+                    rc = ENOMEM;
+            }
+            continue;
+        }
+        if (!in_section)
+            continue;
+
+        if (!strcmp(keyword, "EndSection")) {
+            rc = Conf_Add_Section(conf, &section, skip);
+            in_section = FALSE;
+            continue;
+        }
+        if (n < 1)
+            continue;
+
+        field = NULL;
+        type = 0;
+        if (!strcmp(keyword, "Identifier"))
+            field = &section.identifier;
+        else if (!strcmp(keyword, "MatchProduct"))
+            field = &section.match_product;
+        else if (!strcmp(keyword, "MatchUSBID"))
+            field = &section.match_usbid;
+        else if (!strcmp(keyword, "MatchDevicePath"))
+            field = &section.match_path;
+        else if (!strcmp(keyword, "Driver") && strcmp(args[0], "cmt"))
+            skip = TRUE;
+        else if (!strcmp(keyword, "MatchIsTouchpad"))
+            type = BOARD_MATCH_TOUCHPAD;
+        else if (!strcmp(keyword, "MatchIsTouchscreen"))
+            type = BOARD_MATCH_TOUCHSCREEN;
+        else if (!strcmp(keyword, "MatchIsPointer"))
+            type = BOARD_MATCH_POINTER;
+        else if (!strncmp(keyword, "Match", 5) ||
+                 !strncmp(keyword, "NoMatch", 7))
+            skip = TRUE;
+        else if (!strcmp(keyword, "Option"))
+            rc = Conf_Add_Option(&section, args[0], n >= 2 ? args[1] : "");
+
+        if (type && !Conf_Match_Type(&section, args[0], type))
+            skip = TRUE;
+        if (field) {
+            free((char*)*field);
+            *field = strdup(args[0]);
+            if (!*field)
+                rc = ENOMEM;
+        }
+    }
+
+    Conf_Free_Section(&section);
+    fclose(fp);
+
+    return rc;
+}
+
+static int
+Conf_Filter(const struct dirent* entry)
+{
+    size_t len = strlen(entry->d_name);
+
+    return entry->d_name[0] != '.' && len > 5 &&
+           !strcmp(entry->d_name + len - 5, ".conf");
+}
+
+int
+Conf_Load_Dir(ConfPtr conf, const char* dir)
+{
+    struct dirent** entries;
+    char path[PATH_MAX];
+    int rc = Success;
+    int n, i;
+
+    n = scandir(dir, &entries, Conf_Filter, alphasort);
+    if (n < 0)
+        return errno;
+
+    for (i = 0; i < n; i++) {
+        if (rc == Success) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+            rc = Conf_Load_File(conf, path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return rc;
+}
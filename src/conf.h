@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _CONF_H_
+#define _CONF_H_
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "board_table.h"
+
+/*
+ * InputClass sections read from xorg.conf.d style directories at run time,
+ * in the same form as the compiled in board table. Option values are kept
+ * as strings (BOARD_VALUE_STRING). The files are the ones in use, so their
+ * sections apply to every board.
+ */
+
+typedef struct {
+    BoardSection* sections;
+    size_t num_sections;
+} ConfRec, *ConfPtr;
+
+void Conf_Init(ConfPtr);
+
+/*
+ * Append the sections of every *.conf file in a directory, in file name
+ * order. Returns Success, or an errno value if the directory cannot be
+ * read.
+ */
+int Conf_Load_Dir(ConfPtr, const char*);
+void Conf_Free(ConfPtr);
+
+#endif
@@ -0,0 +1,233 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "conf.h"
+#include "options.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+class ConfTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/conf_test.XXXXXX";
+
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    Conf_Init(&conf_);
+  }
+
+  virtual void TearDown() {
+    Conf_Free(&conf_);
+    for (size_t i = 0; i < files_.size(); i++)
+      unlink(files_[i].c_str());
+    rmdir(dir_.c_str());
+  }
+
+  void Write(const char* name, const char* contents) {
+    std::string path = dir_ + "/" + name;
+    FILE* fp = fopen(path.c_str(), "w");
+
+    ASSERT_TRUE(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+    files_.push_back(path);
+  }
+
+  std::string dir_;
+  std::vector<std::string> files_;
+  ConfRec conf_;
+};
+
+// Files load in name order; only the InputClass sections that can apply
+// to a cmt device are kept.
+TEST_F(ConfTest, LoadsInputClassSections) {
+  Write("20-b.conf",
+        "Section \"InputClass\"\n"
+        "    Identifier \"second\"\n"
+        "    MatchUSBID \"04f3:*\"\n"
+        "    Option \"Tap Enable\" \"0\"\n"
+        "EndSection\n");
+  Write("10-a.conf",
+        "# A comment\n"
+        "Section \"InputClass\"\n"
+        "    Identifier      \"first\"\n"
+        "    MatchIsTouchpad \"on\"\n"
+        "    MatchProduct    \"Elan|cyapa\"\n"
+        "    MatchDevicePath \"/dev/input/event*\"\n"
+        "    Driver          \"cmt\"\n"
+        "    Option          \"Tap Enable\" \"1\"\n"
+        "    Option          \"Bare\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    Identifier \"evdev\"\n"
+        "    Driver \"evdev\"\n"
+        "    Option \"Tap Enable\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    Identifier \"nothing set\"\n"
+        "    MatchIsPointer \"on\"\n"
+        "EndSection\n"
+        "Section \"Device\"\n"
+        "    Option \"Tap Enable\" \"1\"\n"
+        "EndSection\n");
+  Write("30-c.txt",
+        "Section \"InputClass\"\n"
+        "    Option \"Tap Enable\" \"1\"\n"
+        "EndSection\n");
+
+  ASSERT_EQ(Success, Conf_Load_Dir(&conf_, dir_.c_str()));
+  ASSERT_EQ(2u, conf_.num_sections);
+
+  const BoardSection* first = &conf_.sections[0];
+  EXPECT_STREQ("first", first->identifier);
+  EXPECT_EQ(static_cast<unsigned>(BOARD_MATCH_TOUCHPAD), first->match_type);
+  EXPECT_STREQ("Elan|cyapa", first->match_product);
+  EXPECT_STREQ("/dev/input/event*", first->match_path);
+  EXPECT_EQ(NULL, first->match_usbid);
+  ASSERT_EQ(2u, first->num_options);
+  EXPECT_STREQ("Tap Enable", first->options[0].name);
+  EXPECT_STREQ("1", first->options[0].value);
+  EXPECT_EQ(BOARD_VALUE_STRING, first->options[0].type);
+  EXPECT_STREQ("Bare", first->options[1].name);
+  EXPECT_STREQ("", first->options[1].value);
+
+  EXPECT_STREQ("second", conf_.sections[1].identifier);
+  EXPECT_STREQ("04f3:*", conf_.sections[1].match_usbid);
+}
+
+// A board file on disk is in use, so its sections are not limited to the
+// board named in the file name.
+TEST_F(ConfTest, BoardFilesApplyToEveryBoard) {
+  Write("50-touchpad-cmt-link.conf",
+        "Section \"InputClass\"\n"
+        "    MatchIsTouchpad \"on\"\n"
+        "    Option \"Box Width\" \"1.0\"\n"
+        "EndSection\n");
+
+  ASSERT_EQ(Success, Conf_Load_Dir(&conf_, dir_.c_str()));
+  ASSERT_EQ(1u, conf_.num_sections);
+  EXPECT_STREQ("", conf_.sections[0].board);
+  EXPECT_TRUE(OptionIndex_Section_Matches(&conf_.sections[0], NULL,
+                                          BOARD_MATCH_TOUCHPAD, "cyapa",
+                                          "0000:0000", "/dev/input/event0"));
+}
+
+// Match keywords and values the sections cannot express never match, as
+// a section limited by them would not apply to every device.
+TEST_F(ConfTest, UnknownMatchesNeverMatch) {
+  Write("10-a.conf",
+        "Section \"InputClass\"\n"
+        "    MatchIsKeyboard \"on\"\n"
+        "    Option \"A\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    MatchTag \"internal\"\n"
+        "    Option \"B\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    MatchVendor \"Elan\"\n"
+        "    Option \"C\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    NoMatchProduct \"Elan\"\n"
+        "    Option \"D\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    MatchIsTouchpad \"maybe\"\n"
+        "    Option \"E\" \"1\"\n"
+        "EndSection\n"
+        "Section \"InputClass\"\n"
+        "    MatchIsTouchpad \"on\"\n"
+        "    Option \"F\" \"1\"\n"
+        "EndSection\n");
+
+  ASSERT_EQ(Success, Conf_Load_Dir(&conf_, dir_.c_str()));
+  ASSERT_EQ(1u, conf_.num_sections);
+  EXPECT_STREQ("F", conf_.sections[0].options[0].name);
+}
+
+// A false MatchIs* value limits a section to devices not of that kind
+TEST_F(ConfTest, FalseMatchIsExcludesKind) {
+  Write("10-a.conf",
+        "Section \"InputClass\"\n"
+        "    MatchIsTouchpad \"off\"\n"
+        "    MatchIsPointer \"on\"\n"
+        "    Option \"A\" \"1\"\n"
+        "EndSection\n");
+
+  ASSERT_EQ(Success, Conf_Load_Dir(&conf_, dir_.c_str()));
+  ASSERT_EQ(1u, conf_.num_sections);
+  const BoardSection* section = &conf_.sections[0];
+  EXPECT_EQ(static_cast<unsigned>(BOARD_MATCH_POINTER), section->match_type);
+  EXPECT_EQ(static_cast<unsigned>(BOARD_MATCH_TOUCHPAD),
+            section->match_not_type);
+  EXPECT_TRUE(OptionIndex_Section_Matches(section, NULL, BOARD_MATCH_POINTER,
+                                          "mouse", "0000:0000",
+                                          "/dev/input/event0"));
+  EXPECT_FALSE(OptionIndex_Section_Matches(section, NULL,
+                                           BOARD_MATCH_TOUCHPAD, "cyapa",
+                                           "0000:0000", "/dev/input/event0"));
+}
+
+TEST_F(ConfTest, MissingDirectory) {
+  EXPECT_EQ(ENOENT, Conf_Load_Dir(&conf_, "/nonexistent/xorg.conf.d"));
+  EXPECT_EQ(0u, conf_.num_sections);
+}
+
+static bool Matches(const BoardSection& section, const char* board,
+                    unsigned type, const char* product, const char* usbid) {
+  return OptionIndex_Section_Matches(&section, board, type, product, usbid,
+                                     "/dev/input/event3");
+}
+
+// Products match as substrings, USB IDs and paths as globs, each with '|'
+// separated alternatives; the device must have every kind matched.
+TEST(ConfMatchTest, MatchesLikeInputClass) {
+  BoardSection section = BoardSection();
+  const unsigned touchpad = BOARD_MATCH_TOUCHPAD;
+
+  section.board = "";
+  section.match_type = BOARD_MATCH_TOUCHPAD;
+  section.match_product = "Atmel|cyapa";
+  section.match_usbid = "04f3:*|06cb:0001";
+  section.match_path = "/dev/input/event*";
+
+  EXPECT_TRUE(Matches(section, NULL, touchpad, "Atmel maXTouch", "04f3:0010"));
+  EXPECT_TRUE(Matches(section, NULL, touchpad, "cyapa", "06cb:0001"));
+  EXPECT_TRUE(Matches(section, NULL, touchpad | BOARD_MATCH_POINTER, "cyapa",
+                      "06cb:0001"));
+  EXPECT_FALSE(Matches(section, NULL, BOARD_MATCH_POINTER, "cyapa",
+                       "06cb:0001"));
+  EXPECT_FALSE(Matches(section, NULL, touchpad, "Synaptics", "04f3:0010"));
+  EXPECT_FALSE(Matches(section, NULL, touchpad, "cyapa", "06cb:0002"));
+  EXPECT_FALSE(Matches(section, NULL, touchpad, NULL, "04f3:0010"));
+  EXPECT_FALSE(OptionIndex_Section_Matches(&section, NULL, touchpad, "cyapa",
+                                           "04f3:0010", "/dev/hidraw0"));
+
+  // Board sections only apply to the board named
+  section.board = "link";
+  EXPECT_FALSE(Matches(section, NULL, touchpad, "cyapa", "04f3:0010"));
+  EXPECT_FALSE(Matches(section, "lumpy", touchpad, "cyapa", "04f3:0010"));
+  EXPECT_TRUE(Matches(section, "link", touchpad, "cyapa", "04f3:0010"));
+}
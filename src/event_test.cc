@@ -5,31 +5,24 @@
 #include <gtest/gtest.h>
 
 extern "C" {
-#undef __cplusplus
-#define bool bool_
 #define class class_
 #define delete delete_
 #define new new_
 #define private private_
 #define public public_
-#include "libevdev_cmt.h"
-#include "libevdev_event.h"
-#undef bool
+#include <libevdevc/libevdevc.h>
 #undef class
 #undef delete
 #undef new
 #undef private
 #undef public
-#define __cplusplus 1
 }
 
 class EventTest : public ::testing::Test {};
 
 TEST(EventTest, Event_Get_LeftTest) {
-  CmtDeviceRec cmt;
-  InputInfoRec info;
-  info.private_ = &cmt;
-  cmt.absinfo[ABS_X].minimum = 123;
+  static Evdev evdev;
+  evdev.info.absinfo[ABS_X].minimum = 123;
 
-  EXPECT_EQ(123, Event_Get_Left(&info));
+  EXPECT_EQ(123, Event_Get_Left(&evdev));
 }
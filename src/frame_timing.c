@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "frame_timing.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef MSC_TIMESTAMP
+#define MSC_TIMESTAMP 0x05
+#endif
+
+#define FRAME_TIMING_MAX_SCAN 128    /* Events searched back per frame */
+#define FRAME_TIMING_GAP      0.1    /* s without frames before a resync */
+#define FRAME_TIMING_MAX_SKEW 0.02   /* s hardware and kernel may disagree */
+#define FRAME_TIMING_DRIFT    500e-6 /* Slow hardware clock rate followed */
+#define FRAME_TIMING_SMOOTH   (1.0 / 64)
+#define FRAME_TIMING_SLACK    0.0005 /* s a frame may be late unnoticed */
+
+void
+FrameTiming_Init(FrameTimingPtr ft)
+{
+    memset(ft, 0, sizeof(*ft));
+    ft->enabled = TRUE;
+}
+
+/*
+ * The MSC_TIMESTAMP of the current frame, from the raw event log. The log
+ * ends with the SYN_REPORT closing the frame, or with the event before it.
+ */
+static Bool
+FrameTiming_Find(EvdevPtr evdev, uint32_t* raw)
+{
+    size_t i = evdev->debug_buf_tail;
+    const struct input_event* ev;
+    int n;
+
+    for (n = 0; n < FRAME_TIMING_MAX_SCAN; n++) {
+        i = (i + DEBUG_BUF_SIZE - 1) % DEBUG_BUF_SIZE;
+        ev = &evdev->debug_buf[i];
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT && n > 0)
+            break;
+        if (ev->type == EV_MSC && ev->code == MSC_TIMESTAMP) {
+            *raw = ev->value;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+FrameTiming_Update_Stats(FrameTimingStats* stats, double interval)
+{
+    if (stats->mean == 0.0)
+        stats->mean = interval;
+    stats->jitter += FRAME_TIMING_SMOOTH *
+                     (fabs(interval - stats->mean) - stats->jitter);
+    stats->mean += FRAME_TIMING_SMOOTH * (interval - stats->mean);
+}
+
+stime_t
+FrameTiming_Stamp(FrameTimingPtr ft, EvdevPtr evdev, const struct timeval* tv)
+{
+    stime_t kernel = StimeFromTimeval(tv);
+    stime_t dk = kernel - ft->last_kernel;
+    stime_t dh = 0.0;
+    stime_t t;
+    uint32_t raw;
+
+    if (!ft->enabled || !FrameTiming_Find(evdev, &raw)) {
+        ft->synced = FALSE;
+        t = kernel;
+    } else {
+        /* Unsigned difference, so a 32 bit wrap needs no special case */
+        if (ft->synced)
+            dh = (uint32_t)(raw - ft->last_raw) * 1e-6;
+
+        if (!ft->synced || dk > FRAME_TIMING_GAP ||
+            fabs(dh - dk) > FRAME_TIMING_MAX_SKEW) {
+            ft->hw = 0.0;
+            ft->offset = kernel;
+            ft->synced = TRUE;
+        } else {
+            ft->hw += dh;
+            ft->offset += dk * FRAME_TIMING_DRIFT;
+            if (kernel - ft->hw < ft->offset)
+                ft->offset = kernel - ft->hw;
+        }
+        ft->last_raw = raw;
+        t = ft->hw + ft->offset;
+    }
+
+    /* Never step back, also when switching between timebases */
+    if (t < ft->last_time)
+        t = ft->last_time;
+
+    if (ft->last_kernel > 0.0 && dk < FRAME_TIMING_GAP) {
+        if (ft->watch_late && ft->kernel_stats.mean > 0.0 &&
+            dk - ft->kernel_stats.mean > ft->late_limit + FRAME_TIMING_SLACK)
+            ft->late++;
+        FrameTiming_Update_Stats(&ft->kernel_stats, dk);
+        FrameTiming_Update_Stats(&ft->stamp_stats, t - ft->last_time);
+        if (ft->sampling && t > ft->last_time) {
+            ft->samples[ft->num_samples++] = t - ft->last_time;
+            if (ft->num_samples == FRAME_TIMING_SAMPLES)
+                ft->sampling = FALSE;
+        }
+    }
+    ft->last_kernel = kernel;
+    ft->last_time = t;
+
+    return t;
+}
+
+void
+FrameTiming_Sample(FrameTimingPtr ft)
+{
+    ft->num_samples = 0;
+    ft->sampling = TRUE;
+}
+
+static int
+FrameTiming_Compare(const void* a, const void* b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+
+    return (fa > fb) - (fa < fb);
+}
+
+Bool
+FrameTiming_Rate(FrameTimingPtr ft, double* interval, double* jitter)
+{
+    float sorted[FRAME_TIMING_SAMPLES];
+    double median;
+    int i;
+
+    if (ft->sampling || ft->num_samples < FRAME_TIMING_SAMPLES)
+        return FALSE;
+
+    /* Medians, so the odd late or batched frame does not count */
+    memcpy(sorted, ft->samples, sizeof(sorted));
+    qsort(sorted, FRAME_TIMING_SAMPLES, sizeof(float), FrameTiming_Compare);
+    median = sorted[FRAME_TIMING_SAMPLES / 2];
+    for (i = 0; i < FRAME_TIMING_SAMPLES; i++)
+        sorted[i] = fabs(ft->samples[i] - median);
+    qsort(sorted, FRAME_TIMING_SAMPLES, sizeof(float), FrameTiming_Compare);
+
+    *interval = median;
+    *jitter = sorted[FRAME_TIMING_SAMPLES / 2];
+
+    return TRUE;
+}
+
+GesturesPropBool
+FrameTiming_Get_Jitter(void* data)
+{
+    FrameTimingPtr ft = data;
+    double kernel = ft->kernel_stats.jitter * 1000.0;
+    double stamp = ft->stamp_stats.jitter * 1000.0;
+
+    /* Only a change needs to reach the server */
+    if (kernel == ft->jitter[0] && stamp == ft->jitter[1])
+        return FALSE;
+    ft->jitter[0] = kernel;
+    ft->jitter[1] = stamp;
+
+    return TRUE;
+}
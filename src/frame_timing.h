@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _FRAME_TIMING_H_
+#define _FRAME_TIMING_H_
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <gestures/gestures.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "libevdevc/libevdevc.h"
+
+/*
+ * Frame times from the MSC_TIMESTAMP counter of the controller, when it
+ * reports one, instead of the time the kernel read the frame.
+ *
+ * The counter counts microseconds and may wrap. It is unwrapped into a
+ * hardware time, and mapped to the kernel clock by an offset that follows
+ * the smallest kernel-minus-hardware difference seen. Transport latency
+ * only ever adds to that difference, so the offset settles on the fastest
+ * frames, and it creeps up slowly to follow a hardware clock that runs
+ * slow. A pause, a counter reset or a frame without a timestamp puts the
+ * device back on kernel time until the counter can be trusted again.
+ */
+
+/* Frame intervals behind a report rate estimate */
+#define FRAME_TIMING_SAMPLES 256
+
+typedef struct {
+    double mean;    /* Smoothed frame interval */
+    double jitter;  /* Smoothed absolute deviation from it */
+} FrameTimingStats;
+
+typedef struct {
+    GesturesPropBool enabled;  /* "Hardware Timestamps" property storage */
+    Bool synced;         /* The hardware timebase is in use */
+    uint32_t last_raw;   /* Last MSC_TIMESTAMP value */
+    stime_t hw;          /* Unwrapped hardware time since the last sync */
+    stime_t offset;      /* Kernel time of hardware time 0 */
+    stime_t last_kernel;
+    stime_t last_time;   /* Last time handed out */
+
+    FrameTimingStats kernel_stats;
+    FrameTimingStats stamp_stats;
+    double jitter[2];    /* Exported: kernel and stamp jitter in ms */
+
+    /* Frame intervals collected for FrameTiming_Rate */
+    float samples[FRAME_TIMING_SAMPLES];
+    int num_samples;
+    Bool sampling;
+
+    /* Frames arriving later than late_limit after the usual interval */
+    Bool watch_late;
+    stime_t late_limit;
+    int late;
+} FrameTimingRec, *FrameTimingPtr;
+
+void FrameTiming_Init(FrameTimingPtr);
+
+/*
+ * Collect the intervals of the next FRAME_TIMING_SAMPLES frames that
+ * follow one another without a pause.
+ */
+void FrameTiming_Sample(FrameTimingPtr);
+
+/*
+ * Once the samples are in, the median frame interval and the median
+ * absolute deviation from it, in s. Returns FALSE while still sampling.
+ */
+Bool FrameTiming_Rate(FrameTimingPtr, double*, double*);
+
+/*
+ * Time of the frame that just ended with SYN_REPORT at kernel time tv.
+ */
+stime_t FrameTiming_Stamp(FrameTimingPtr, EvdevPtr, const struct timeval*);
+
+/*
+ * Property get handler refreshing jitter.
+ */
+GesturesPropBool FrameTiming_Get_Jitter(void*);
+
+#endif
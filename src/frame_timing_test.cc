@@ -0,0 +1,182 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "frame_timing.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+#ifndef MSC_TIMESTAMP
+#define MSC_TIMESTAMP 0x05
+#endif
+
+class FrameTimingTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // The event log makes it too large for the stack
+    evdev_ = static_cast<EvdevPtr>(calloc(1, sizeof(Evdev)));
+    ASSERT_TRUE(evdev_ != NULL);
+    FrameTiming_Init(&ft_);
+    kernel_us_ = 1000000000LL;  // 1000 s
+  }
+
+  virtual void TearDown() {
+    free(evdev_);
+  }
+
+  void Log(int type, int code, int value) {
+    struct input_event* ev = &evdev_->debug_buf[evdev_->debug_buf_tail];
+
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    evdev_->debug_buf_tail = (evdev_->debug_buf_tail + 1) % DEBUG_BUF_SIZE;
+  }
+
+  // A frame read dt_us after the last one, stamped raw by the controller
+  stime_t Frame(int64_t dt_us, uint32_t raw) {
+    Log(EV_MSC, MSC_TIMESTAMP, static_cast<int>(raw));
+    return FrameWithoutStamp(dt_us);
+  }
+
+  stime_t FrameWithoutStamp(int64_t dt_us) {
+    struct timeval tv;
+
+    Log(EV_SYN, SYN_REPORT, 0);
+    kernel_us_ += dt_us;
+    tv.tv_sec = kernel_us_ / 1000000;
+    tv.tv_usec = kernel_us_ % 1000000;
+    return FrameTiming_Stamp(&ft_, evdev_, &tv);
+  }
+
+  stime_t Kernel() const {
+    return kernel_us_ / 1000000 + kernel_us_ % 1000000 / 1e6;
+  }
+
+  EvdevPtr evdev_;
+  FrameTimingRec ft_;
+  int64_t kernel_us_;
+};
+
+// The 32 bit microsecond counter wraps every 71 minutes; frames across
+// the wrap keep their interval, while the kernel reads every other one late
+TEST_F(FrameTimingTest, CounterWrapsAround) {
+  uint32_t raw = 0xffffffffu - 40000;
+  stime_t last = Frame(8000, raw);
+  int late = 0;
+  stime_t t;
+
+  for (int i = 0; i < 20; i++) {
+    int lat = i % 2 ? 1500 : 0;
+
+    raw += 8000;
+    t = Frame(8000 + lat - late, raw);
+    late = lat;
+    EXPECT_NEAR(0.008, t - last, 2e-5) << "frame " << i;
+    EXPECT_TRUE(ft_.synced);
+    last = t;
+  }
+  EXPECT_LT(raw, 0x10000000u);
+}
+
+// Transport latency is taken off: frames read late by the kernel keep the
+// controller's interval, up to the drift the offset allows between the
+// frames with the least latency
+TEST_F(FrameTimingTest, RemovesTransportJitter) {
+  static const int kLatency[] = { 0, 3000, 500, 2000, 0, 1500, 2500, 100 };
+  uint32_t raw = 5000;
+  int late = 0;
+  stime_t last = Frame(8000, raw);
+  stime_t t;
+
+  for (int i = 1; i < 200; i++) {
+    int lat = kLatency[i % 8];
+
+    raw += 8000;
+    t = Frame(8000 + lat - late, raw);
+    late = lat;
+    EXPECT_NEAR(0.008, t - last, 2e-5) << "frame " << i;
+    EXPECT_LE(t, Kernel());
+    last = t;
+  }
+  EXPECT_TRUE(ft_.synced);
+}
+
+// A hardware clock running slow against the kernel clock is followed, so
+// the stamps do not fall behind the kernel time over a long session
+TEST_F(FrameTimingTest, FollowsSlowHardwareClock) {
+  uint32_t raw = 0;
+  stime_t t = Frame(8000, raw);
+  int i;
+
+  // 250 ppm slow, for 80 s: 20 ms behind without the drift correction
+  for (i = 0; i < 10000; i++) {
+    raw += 8000;
+    t = Frame(8002, raw);
+  }
+  EXPECT_TRUE(ft_.synced);
+  EXPECT_NEAR(Kernel(), t, 0.0005);
+}
+
+TEST_F(FrameTimingTest, FollowsFastHardwareClock) {
+  uint32_t raw = 0;
+  stime_t t = Frame(8000, raw);
+  int i;
+
+  for (i = 0; i < 10000; i++) {
+    raw += 8000;
+    t = Frame(7998, raw);
+  }
+  EXPECT_TRUE(ft_.synced);
+  EXPECT_NEAR(Kernel(), t, 1e-6);
+}
+
+// A pause, a counter reset or a frame without a stamp goes back to kernel
+// time, and the stamps never step back
+TEST_F(FrameTimingTest, ResyncsToKernelTime) {
+  uint32_t raw = 100000;
+  stime_t last = Frame(8000, raw);
+  stime_t t;
+
+  raw += 8000;
+  t = Frame(8000, raw);
+  EXPECT_NEAR(last + 0.008, t, 1e-7);
+
+  // Pause
+  raw += 500000;
+  t = Frame(200000, raw);
+  EXPECT_DOUBLE_EQ(Kernel(), t);
+
+  // Counter reset
+  last = t;
+  t = Frame(8000, 0);
+  EXPECT_DOUBLE_EQ(Kernel(), t);
+  EXPECT_GT(t, last);
+
+  // No stamp
+  t = FrameWithoutStamp(8000);
+  EXPECT_FALSE(ft_.synced);
+  EXPECT_DOUBLE_EQ(Kernel(), t);
+
+  // Disabled
+  ft_.enabled = FALSE;
+  last = t;
+  t = Frame(-1000, 16000);
+  EXPECT_FALSE(ft_.synced);
+  EXPECT_DOUBLE_EQ(last, t);
+}
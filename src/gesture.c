@@ -6,7 +6,9 @@
 
 #include "gesture.h"
 
+#include <signal.h>
 #include <time.h>
+#include <sys/ioctl.h>
 
 #include <gestures/gestures.h>
 #include <xorg/xf86_OSproc.h>
@@ -14,15 +16,6 @@
 #include "cmt.h"
 #include "properties.h"
 
-// Helper for bit operations
-#define LONG_BITS (sizeof(long) * 8)
-
-// Implementation of inline bit operations
-static inline bool TestBit(int bit, unsigned long* array)
-{
-    return !!(array[bit / LONG_BITS] & (1L << (bit % LONG_BITS)));
-}
-
 // This array maps input_event button types to gestures buttons
 #define EVDEV_BUTTON_MAP_SIZE 7
 static const int kEvdevButtonMap[EVDEV_BUTTON_MAP_SIZE][2] = {
@@ -38,6 +31,24 @@ static const int kEvdevButtonMap[EVDEV_BUTTON_MAP_SIZE][2] = {
 // Conversion from kernel key codes to xorg key codes
 #define MIN_KEYCODE 8
 
+/* Events searched back per frame for the pen axes */
+#define GESTURE_PEN_MAX_SCAN 128
+
+/* Cache line size the per-frame state is laid out for */
+#define GESTURE_ARENA_ALIGN 64
+
+/*
+ * Set the value of a CMT_AXIS in the mask, if the device registered it.
+ */
+static inline void SetAxis(CmtDevicePtr cmt, ValuatorMask* mask, int axis,
+                           double value)
+{
+    int valuator = cmt->axis_map[axis];
+
+    if (valuator >= 0)
+        valuator_mask_set_double(mask, valuator, value);
+}
+
 /*
  * Gestures timer functions
  */
@@ -74,28 +85,126 @@ static void Gesture_Gesture_Ready(void* client_data,
 
 static enum GestureInterpreterDeviceClass Gesture_Device_Class(EvdevClass cls);
 
-int
-Gesture_Init(GesturePtr rec, size_t max_fingers)
+static void Gesture_Interpreter_Init(GesturePtr);
+
+static stime_t Gesture_Now(int is_monotonic);
+
+/*
+ * Round an arena offset up to the next cache line.
+ */
+static size_t
+Gesture_Arena_Align(size_t offset)
+{
+    return (offset + GESTURE_ARENA_ALIGN - 1) &
+           ~(size_t)(GESTURE_ARENA_ALIGN - 1);
+}
+
+static void*
+Gesture_Construct(void* data)
 {
+    GesturePtr rec = data;
+
     rec->interpreter = NewGestureInterpreter();
+    return NULL;
+}
+
+/*
+ * Build the interpreter on a thread of its own. Nothing of the server is
+ * touched while it runs, and no signal is delivered to it. Returns FALSE if
+ * the thread could not be started.
+ */
+static Bool
+Gesture_Construct_Start(GesturePtr rec)
+{
+    sigset_t all, saved;
+    int rc;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    rc = pthread_create(&rec->construct_thread, NULL, Gesture_Construct, rec);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    rec->constructing = (rc == 0);
+    return rec->constructing;
+}
+
+/*
+ * Collect the interpreter started by Gesture_Init. rec->interpreter must not
+ * be read or written before this returns, so every entry point that uses it
+ * from the main thread calls it first. Returns FALSE if no interpreter could
+ * be built.
+ */
+static Bool
+Gesture_Wait(GesturePtr rec)
+{
+    if (!rec->constructing)
+        return TRUE;
+    pthread_join(rec->construct_thread, NULL);
+    rec->constructing = FALSE;
+    return rec->interpreter != NULL;
+}
+
+int
+Gesture_Init(GesturePtr rec, size_t max_fingers, Bool with_interpreter)
+{
+    size_t slot_states_offset;
+    size_t fingers_offset;
+    size_t size;
+
+    rec->interpreter = NULL;
+    rec->constructing = FALSE;
+    rec->arena = NULL;
     rec->slot_states = NULL;
+    rec->mask = NULL;
+    GestureStream_Init(&rec->stream);
+    FrameTiming_Init(&rec->timing);
+
+    /* Key bits, slot states and fingers, each on its own cache lines */
+    slot_states_offset =
+        Gesture_Arena_Align(NLONGS(KEY_CNT) * sizeof(unsigned long));
+    fingers_offset = Gesture_Arena_Align(slot_states_offset +
+                                         max_fingers * sizeof(int));
+    size = Gesture_Arena_Align(fingers_offset +
+                               max_fingers * sizeof(struct FingerState));
+    if (posix_memalign(&rec->arena, GESTURE_ARENA_ALIGN, size)) {
+        rec->arena = NULL;
+        return BadAlloc;
+    }
+    memset(rec->arena, 0, size);
+    rec->prev_key_state = rec->arena;
+    rec->slot_states = (int*)((char*)rec->arena + slot_states_offset);
+    rec->fingers = (struct FingerState*)((char*)rec->arena + fingers_offset);
+    rec->max_fingers = max_fingers;
 
-    if (!rec->interpreter)
-        return !Success;
-    rec->fingers = malloc(max_fingers * sizeof(struct FingerState));
-    if (!rec->fingers)
-        goto Error_Alloc_Fingers;
+    /* The mask layout is private to the server */
     rec->mask = valuator_mask_new(MAX_VALUATORS);
     if (!rec->mask)
         goto Error_Alloc_Mask;
+
+    rec->metrics = calloc(1, sizeof(*rec->metrics));
+    if (!rec->metrics)
+        goto Error_Alloc_Metrics;
+
+    /*
+     * The rest of PreInit, DeviceInit's class setup and PropertiesInit go on
+     * while the interpreter is built; Gesture_Device_Init collects it.
+     */
+    if (with_interpreter && !Gesture_Construct_Start(rec)) {
+        rec->interpreter = NewGestureInterpreter();
+        if (!rec->interpreter)
+            goto Error_Alloc_Interpreter;
+    }
     return Success;
 
+Error_Alloc_Interpreter:
+    free(rec->metrics);
+    rec->metrics = NULL;
+Error_Alloc_Metrics:
+    valuator_mask_free(&rec->mask);
 Error_Alloc_Mask:
-    free(rec->fingers);
+    free(rec->arena);
+    rec->arena = NULL;
+    rec->slot_states = NULL;
     rec->fingers = NULL;
-Error_Alloc_Fingers:
-    DeleteGestureInterpreter(rec->interpreter);
-    rec->interpreter = NULL;
     return BadAlloc;
 }
 
@@ -103,20 +212,21 @@ void
 Gesture_Free(GesturePtr rec)
 {
     // free gesture interpreter first, this will cancel all timers.
+    Gesture_Wait(rec);
     DeleteGestureInterpreter(rec->interpreter);
     rec->interpreter = NULL;
     rec->dev = NULL;
 
-    valuator_mask_free(&rec->mask);
+    GestureStream_Close(&rec->stream);
 
-    if (rec->fingers) {
-        free(rec->fingers);
-        rec->fingers = NULL;
-    }
-    if(rec->slot_states) {
-        free(rec->slot_states);
-        rec->slot_states = NULL;
-    }
+    free(rec->metrics);
+    rec->metrics = NULL;
+    valuator_mask_free(&rec->mask);
+    free(rec->arena);
+    rec->arena = NULL;
+    rec->prev_key_state = NULL;
+    rec->slot_states = NULL;
+    rec->fingers = NULL;
 }
 
 void
@@ -125,14 +235,39 @@ Gesture_Device_Init(GesturePtr rec, DeviceIntPtr dev)
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
     CmtPropertiesPtr props = &cmt->props;
-    EventStatePtr evstate = &cmt->evstate;
-    struct HardwareProperties hwprops;
-    EvdevPtr evdev = &cmt->evdev;
-    int i;
+    size_t i;
 
     /* Store the device for which to generate gestures */
     rec->dev = dev;
 
+    if (!Gesture_Wait(rec))
+        ERR(info, "Cannot create the gestures interpreter\n");
+
+    /* Start over on every DeviceInit; the arena lives until UnInit */
+    for (i = 0; i < rec->max_fingers; ++i)
+        rec->slot_states[i] = SLOT_STATUS_FREE;
+
+    if (props->gesture_stream)
+        Gesture_Stream_Set(rec);
+
+    /* Direct touch devices run without one, until gestures are enabled */
+    if (rec->interpreter)
+        Gesture_Interpreter_Init(rec);
+}
+
+/*
+ * Hand the device properties and hardware description to a new interpreter.
+ */
+static void
+Gesture_Interpreter_Init(GesturePtr rec)
+{
+    InputInfoPtr info = rec->dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    EventStatePtr evstate = &cmt->evstate;
+    struct HardwareProperties hwprops;
+    EvdevPtr evdev = &cmt->evdev;
+
     /* TODO: support different models */
     hwprops.left            = props->area_left;
     hwprops.top             = props->area_top;
@@ -159,19 +294,74 @@ Gesture_Device_Init(GesturePtr rec, DeviceIntPtr dev)
             rec->interpreter,
             Gesture_Device_Class(cmt->evdev.info.evdev_class));
     GestureInterpreterSetHardwareProperties(rec->interpreter, &hwprops);
+}
 
-    rec->slot_states = malloc(sizeof(int) * evstate->slot_count);
-    if (!rec->slot_states) {
-        ERR(info, "BadAlloc: rec->slot_states");
+void
+Gesture_Interpreter_Set(void* data)
+{
+    GesturePtr rec = data;
+    InputInfoPtr info;
+    CmtDevicePtr cmt;
+
+    if (!rec->dev)
+        return;
+    Gesture_Wait(rec);
+    info = rec->dev->public.devicePrivate;
+    cmt = info->private;
+
+    /*
+     * Built the first time gestures are enabled and kept afterwards;
+     * frames skip it again while they are disabled.
+     */
+    if (!cmt->props.touchscreen_gestures || rec->interpreter)
+        return;
+    rec->interpreter = NewGestureInterpreter();
+    if (!rec->interpreter) {
+        ERR(info, "Cannot create the gestures interpreter\n");
         return;
     }
-    for (i = 0; i < evstate->slot_count; ++i)
-        rec->slot_states[i] = SLOT_STATUS_FREE;
+    Gesture_Interpreter_Init(rec);
+    if (rec->dev->public.on)
+        Gesture_Device_On(rec);
+    xf86IDrvMsg(info, X_INFO, "Created the gestures interpreter\n");
+}
+
+/*
+ * Read the pen axes once when the device is opened; from then on they are
+ * followed through the event stream by Gesture_Pen_Scan.
+ */
+static void
+Gesture_Pen_Seed(GesturePtr rec, int fd)
+{
+    static const int codes[] = {
+        ABS_X, ABS_Y, ABS_PRESSURE, ABS_TILT_X, ABS_TILT_Y
+    };
+    int* values[] = {
+        &rec->pen.x, &rec->pen.y, &rec->pen.pressure,
+        &rec->pen.tilt_x, &rec->pen.tilt_y
+    };
+    struct input_absinfo absinfo;
+    size_t i;
+
+    memset(&rec->pen, 0, sizeof(rec->pen));
+    for (i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+        if (ioctl(fd, EVIOCGABS(codes[i]), &absinfo) == 0)
+            *values[i] = absinfo.value;
+    }
 }
 
 void
 Gesture_Device_On(GesturePtr rec)
 {
+    InputInfoPtr info = rec->dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+
+    if (cmt->has_tilt || cmt->has_st_pen)
+        Gesture_Pen_Seed(rec, info->fd);
+
+    Gesture_Wait(rec);
+    if (!rec->interpreter)
+        return;
     GestureInterpreterSetTimerProvider(rec->interpreter,
                                        &Gesture_GesturesTimerProvider,
                                        rec->dev);
@@ -182,16 +372,179 @@ Gesture_Device_On(GesturePtr rec)
 void
 Gesture_Device_Off(GesturePtr rec)
 {
+    Gesture_Wait(rec);
+    if (!rec->interpreter)
+        return;
     GestureInterpreterSetCallback(rec->interpreter, NULL, NULL);
 }
 
 void
 Gesture_Device_Close(GesturePtr rec)
 {
+    Gesture_Wait(rec);
+    if (!rec->interpreter)
+        return;
     GestureInterpreterSetPropProvider(rec->interpreter, NULL, NULL);
     GestureInterpreterSetTimerProvider(rec->interpreter, NULL, NULL);
 }
 
+/*
+ * Follow the pen axes that are not part of the MT slot state through the
+ * events of the frame that just ended, newest first.
+ */
+static void
+Gesture_Pen_Scan(GesturePtr rec, EvdevPtr evdev)
+{
+    size_t i = evdev->debug_buf_tail;
+    const struct input_event* ev;
+    unsigned seen = 0;
+    unsigned bit;
+    int* value;
+    int n;
+
+    for (n = 0; n < GESTURE_PEN_MAX_SCAN; n++) {
+        i = (i + DEBUG_BUF_SIZE - 1) % DEBUG_BUF_SIZE;
+        ev = &evdev->debug_buf[i];
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT && n > 0)
+            break;
+        if (ev->type != EV_ABS)
+            continue;
+        switch (ev->code) {
+        case ABS_X:        bit = 1 << 0; value = &rec->pen.x; break;
+        case ABS_Y:        bit = 1 << 1; value = &rec->pen.y; break;
+        case ABS_PRESSURE: bit = 1 << 2; value = &rec->pen.pressure; break;
+        case ABS_TILT_X:   bit = 1 << 3; value = &rec->pen.tilt_x; break;
+        case ABS_TILT_Y:   bit = 1 << 4; value = &rec->pen.tilt_y; break;
+        default:
+            continue;
+        }
+        if (!(seen & bit))
+            *value = ev->value;
+        seen |= bit;
+    }
+}
+
+/*
+ * Post a pen position as absolute motion with pressure and tilt, and the
+ * tip contact as the left button.
+ */
+static void
+Gesture_Process_Pen(GesturePtr rec, int x, int y, int pressure, Bool down)
+{
+    DeviceIntPtr dev = rec->dev;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    ValuatorMask* mask = rec->mask;
+
+    valuator_mask_zero(mask);
+    SetAxis(cmt, mask, CMT_AXIS_X, x);
+    SetAxis(cmt, mask, CMT_AXIS_Y, y);
+    SetAxis(cmt, mask, CMT_AXIS_PEN_PRESSURE, pressure);
+    if (cmt->has_tilt) {
+        SetAxis(cmt, mask, CMT_AXIS_PEN_TILT_X, rec->pen.tilt_x);
+        SetAxis(cmt, mask, CMT_AXIS_PEN_TILT_Y, rec->pen.tilt_y);
+    }
+    xf86PostMotionEventM(dev, TRUE, mask);
+
+    if (down != rec->pen_down) {
+        xf86PostButtonEventM(dev, TRUE, CMT_BTN_LEFT, down, mask);
+        rec->pen_down = down;
+    }
+
+    /* Keep pen values out of the touch events that follow */
+    valuator_mask_zero(mask);
+}
+
+/*
+ * Post a pen tracked in an MT slot. Without pressure, it is touching the
+ * surface.
+ */
+static void
+Gesture_Process_Slot_Pen(GesturePtr rec, MtSlotPtr slot)
+{
+    InputInfoPtr info = rec->dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    Bool down = TRUE;
+
+    if (TestBit(ABS_MT_PRESSURE, cmt->evdev.info.abs_bitmask))
+        down = slot->pressure > 0;
+    Gesture_Process_Pen(rec, slot->position_x, slot->position_y,
+                        slot->pressure, down);
+}
+
+/*
+ * Release the pen tip when the pen leaves the surface.
+ */
+static void
+Gesture_Pen_Up(GesturePtr rec)
+{
+    valuator_mask_zero(rec->mask);
+    if (rec->pen_down)
+        xf86PostButtonEventM(rec->dev, TRUE, CMT_BTN_LEFT, 0, rec->mask);
+    rec->pen_down = FALSE;
+}
+
+/*
+ * Post a single touch pen, while BTN_TOOL_PEN is set. Its position is
+ * scaled to the MT range the X/Y axes were registered with, if the device
+ * has one. The tip is down with BTN_TOUCH, or else with pressure.
+ */
+static void
+Gesture_Process_ST_Pen(GesturePtr rec)
+{
+    InputInfoPtr info = rec->dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    EvdevPtr evdev = &cmt->evdev;
+    const struct input_absinfo* absinfo = evdev->info.absinfo;
+    double x = rec->pen.x;
+    double y = rec->pen.y;
+    Bool down = TRUE;
+
+    if (!TestBit(BTN_TOOL_PEN, evdev->key_state_bitmask)) {
+        if (rec->pen.in_prox)
+            Gesture_Pen_Up(rec);
+        rec->pen.in_prox = FALSE;
+        return;
+    }
+    rec->pen.in_prox = TRUE;
+
+    if (TestBit(ABS_MT_POSITION_X, evdev->info.abs_bitmask) &&
+        absinfo[ABS_X].maximum > absinfo[ABS_X].minimum &&
+        absinfo[ABS_Y].maximum > absinfo[ABS_Y].minimum) {
+        x = absinfo[ABS_MT_POSITION_X].minimum +
+            (x - absinfo[ABS_X].minimum) *
+            (absinfo[ABS_MT_POSITION_X].maximum -
+             absinfo[ABS_MT_POSITION_X].minimum) /
+            (absinfo[ABS_X].maximum - absinfo[ABS_X].minimum);
+        y = absinfo[ABS_MT_POSITION_Y].minimum +
+            (y - absinfo[ABS_Y].minimum) *
+            (absinfo[ABS_MT_POSITION_Y].maximum -
+             absinfo[ABS_MT_POSITION_Y].minimum) /
+            (absinfo[ABS_Y].maximum - absinfo[ABS_Y].minimum);
+    }
+
+    if (TestBit(BTN_TOUCH, evdev->info.key_bitmask))
+        down = TestBit(BTN_TOUCH, evdev->key_state_bitmask);
+    else if (TestBit(ABS_PRESSURE, evdev->info.abs_bitmask))
+        down = rec->pen.pressure > 0;
+    Gesture_Process_Pen(rec, x, y, rec->pen.pressure, down);
+}
+
+/*
+ * Apply the non-linearity correction to the finger of a frame. As in the
+ * gestures library, frames with more fingers are left alone. Pressure is
+ * only a coordinate into the grid; the data has no pressure error, so it
+ * is not written back.
+ */
+static void
+Gesture_Correct_Linearity(GesturePtr rec, LinearityPtr lin)
+{
+    struct FingerState* finger = &rec->fingers[0];
+
+    Linearity_Correct(lin, &finger->position_x, &finger->position_y,
+                      &finger->pressure, 1);
+}
+
 void
 Gesture_Process_Slots(void* vrec,
                       EventStatePtr evstate,
@@ -211,33 +564,46 @@ Gesture_Process_Slots(void* vrec,
     unsigned long key_state_diff[NLONGS(KEY_CNT)];
     int code;
     int value;
+    stime_t now;
 
-    if (!rec->interpreter || ! rec->slot_states)
+    if (!rec->slot_states)
         return;
 
-    /* handle changed keys */
-    for (i = 0; i < NLONGS(KEY_CNT); ++i) {
-        key_state_diff[i] = evdev->key_state_bitmask[i] ^
-                            cmt->prev_key_state[i];
-    }
-    for (i = 0; i < KEY_CNT; ++i) {
-        if (TestBit(i, key_state_diff)) {
-            code = i + MIN_KEYCODE;
-            value = TestBit(i, evdev->key_state_bitmask);
-            xf86PostKeyboardEvent(dev, code, value);
+    now = FrameTiming_Stamp(&rec->timing, evdev, tv);
+
+    if (cmt->has_tilt || cmt->has_st_pen)
+        Gesture_Pen_Scan(rec, evdev);
+
+    /* handle changed keys, if the device has the keyboard class */
+    if (dev->key) {
+        for (i = 0; i < NLONGS(KEY_CNT); ++i) {
+            key_state_diff[i] = evdev->key_state_bitmask[i] ^
+                                rec->prev_key_state[i];
+        }
+        for (i = 0; i < KEY_CNT; ++i) {
+            if (TestBit(i, key_state_diff)) {
+                code = i + MIN_KEYCODE;
+                value = TestBit(i, evdev->key_state_bitmask);
+                xf86PostKeyboardEvent(dev, code, value);
+            }
         }
     }
     for (i = 0; i < NLONGS(KEY_CNT); ++i) {
-        cmt->prev_key_state[i] = evdev->key_state_bitmask[i];
+        rec->prev_key_state[i] = evdev->key_state_bitmask[i];
     }
     /* zero initialize all FingerStates to clear out previous state. */
-    memset(rec->fingers, 0,
-           Event_Get_Slot_Count(evdev) * sizeof(struct FingerState));
+    memset(rec->fingers, 0, rec->max_fingers * sizeof(struct FingerState));
 
     /* clear out previous state from valuator */
     valuator_mask_zero(mask);
 
-    if (cmt->props.raw_passthrough) {
+    /*
+     * Direct touch devices take the raw path, with no interpreter work,
+     * unless gestures are enabled for them.
+     */
+    if ((cmt->props.direct_touch &&
+         !(cmt->props.touchscreen_gestures && rec->interpreter)) ||
+        (cmt->props.raw_passthrough && dev->touch)) {
         for (i = 0; i < evstate->slot_count; i++) {
             slot = &evstate->slots[i];
 
@@ -245,27 +611,40 @@ Gesture_Process_Slots(void* vrec,
             if (slot->tracking_id == -1) {
                 if (rec->slot_states[i] == SLOT_STATUS_RAW) {
                     xf86PostTouchEvent(dev, i, XI_TouchEnd, 0, mask);
+                } else if (rec->slot_states[i] == SLOT_STATUS_PEN) {
+                    Gesture_Pen_Up(rec);
                 }
                 rec->slot_states[i] = SLOT_STATUS_FREE;
                 continue;
             }
 
+            /*
+             * Pens are posted as absolute pointer motion in slot order, so
+             * they stay ordered with the touches of the same frame.
+             */
+            if (cmt->has_pen && slot->tool_type == MT_TOOL_PEN) {
+                if (rec->slot_states[i] == SLOT_STATUS_RAW)
+                    xf86PostTouchEvent(dev, i, XI_TouchEnd, 0, mask);
+                Gesture_Process_Slot_Pen(rec, slot);
+                rec->slot_states[i] = SLOT_STATUS_PEN;
+                continue;
+            }
+            if (rec->slot_states[i] == SLOT_STATUS_PEN) {
+                Gesture_Pen_Up(rec);
+                rec->slot_states[i] = SLOT_STATUS_FREE;
+            }
+
             /*
              * valuators 0 (CMT_AXIS_X) and 1 (CMT_AXIS_Y) are hardcoded into
              * X.org as finger position, so we need to set those too.
              */
-            valuator_mask_set_double(mask, CMT_AXIS_MT_POSITION_X,
-                                     slot->position_x);
-            valuator_mask_set_double(mask, CMT_AXIS_MT_POSITION_Y,
-                                     slot->position_y);
-            valuator_mask_set_double(mask, CMT_AXIS_MT_PRESSURE,
-                                     slot->pressure);
-            valuator_mask_set_double(mask, CMT_AXIS_MT_TOUCH_MAJOR,
-                                     slot->touch_major);
-            valuator_mask_set_double(mask, CMT_AXIS_TOUCH_TIMESTAMP,
-                                     StimeFromTimeval(tv));
-            valuator_mask_set_double(mask, CMT_AXIS_X, slot->position_x);
-            valuator_mask_set_double(mask, CMT_AXIS_Y, slot->position_y);
+            SetAxis(cmt, mask, CMT_AXIS_MT_POSITION_X, slot->position_x);
+            SetAxis(cmt, mask, CMT_AXIS_MT_POSITION_Y, slot->position_y);
+            SetAxis(cmt, mask, CMT_AXIS_MT_PRESSURE, slot->pressure);
+            SetAxis(cmt, mask, CMT_AXIS_MT_TOUCH_MAJOR, slot->touch_major);
+            SetAxis(cmt, mask, CMT_AXIS_TOUCH_TIMESTAMP, now);
+            SetAxis(cmt, mask, CMT_AXIS_X, slot->position_x);
+            SetAxis(cmt, mask, CMT_AXIS_Y, slot->position_y);
 
             if (rec->slot_states[i] == SLOT_STATUS_RAW) {
                 xf86PostTouchEvent(dev, i, XI_TouchUpdate, 0, mask);
@@ -279,14 +658,20 @@ Gesture_Process_Slots(void* vrec,
             rec->slot_states[i] = SLOT_STATUS_RAW;
         }
 
-        if (has_gesture_fingers) {
+        if (cmt->has_st_pen)
+            Gesture_Process_ST_Pen(rec);
+
+        if (has_gesture_fingers && rec->interpreter) {
             /* push empty hardware state to clear interpreter state */
-            hwstate.timestamp = StimeFromTimeval(tv);
+            hwstate.timestamp = now;
             GestureInterpreterPushHardwareState(rec->interpreter, &hwstate);
         }
         return;
     }
 
+    if (!rec->interpreter)
+        return;
+
     current_finger = 0;
     for (i = 0; i < evstate->slot_count; i++) {
         slot = &evstate->slots[i];
@@ -313,7 +698,11 @@ Gesture_Process_Slots(void* vrec,
         rec->fingers[current_finger].tracking_id = slot->tracking_id;
         current_finger++;
     }
-    hwstate.timestamp = StimeFromTimeval(tv);
+    hwstate.timestamp = now;
+
+    if (cmt->linearity && cmt->props.linearity_correction &&
+        current_finger == 1)
+        Gesture_Correct_Linearity(rec, cmt->linearity);
 
     for (i = 0; i < EVDEV_BUTTON_MAP_SIZE; ++i) {
         if (Event_Get_Button(evdev, kEvdevButtonMap[i][0]))
@@ -330,26 +719,43 @@ Gesture_Process_Slots(void* vrec,
     GestureInterpreterPushHardwareState(rec->interpreter, &hwstate);
 }
 
+/*
+ * Post a motion event, unless none of its axes are registered.
+ */
+static void PostMotion(DeviceIntPtr dev, BOOL is_absolute,
+                       const ValuatorMask* mask)
+{
+    if (valuator_mask_num_valuators(mask) > 0)
+        xf86PostMotionEventM(dev, is_absolute, mask);
+}
+
 static void SetTimeValues(ValuatorMask* mask,
                           const struct Gesture* gesture,
                           DeviceIntPtr dev,
                           BOOL is_absolute)
 {
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    int start_axis = cmt->axis_map[CMT_AXIS_DBL_START_TIME];
+    int end_axis = cmt->axis_map[CMT_AXIS_DBL_END_TIME];
     double start_time = gesture->start_time;
     double end_time = gesture->end_time;
 
+    if (start_axis < 0 || end_axis < 0)
+        return;
+
     if (!is_absolute) {
         /*
          * We send the movement axes as relative values, which causes the
          * times to be sent as relative values too. This code computes the
          * right relative values.
          */
-        start_time -= dev->last.valuators[CMT_AXIS_DBL_START_TIME];
-        end_time -= dev->last.valuators[CMT_AXIS_DBL_END_TIME];
+        start_time -= dev->last.valuators[start_axis];
+        end_time -= dev->last.valuators[end_axis];
     }
 
-    valuator_mask_set_double(mask, CMT_AXIS_DBL_START_TIME, start_time);
-    valuator_mask_set_double(mask, CMT_AXIS_DBL_END_TIME, end_time);
+    valuator_mask_set_double(mask, start_axis, start_time);
+    valuator_mask_set_double(mask, end_axis, end_time);
 }
 
 static void SetOrdinalValues(ValuatorMask* mask,
@@ -357,18 +763,150 @@ static void SetOrdinalValues(ValuatorMask* mask,
                              float x,
                              float y,
                              BOOL is_absolute) {
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    int x_axis = cmt->axis_map[CMT_AXIS_ORDINAL_X];
+    int y_axis = cmt->axis_map[CMT_AXIS_ORDINAL_Y];
+
+    if (x_axis < 0 || y_axis < 0)
+        return;
+
     if (!is_absolute) {
         /*
          * We send the movement axes as relative values, which causes the
          * times to be sent as relative values too. This code computes the
          * right relative values.
          */
-        x -= dev->last.valuators[CMT_AXIS_ORDINAL_X];
-        y -= dev->last.valuators[CMT_AXIS_ORDINAL_Y];
+        x -= dev->last.valuators[x_axis];
+        y -= dev->last.valuators[y_axis];
+    }
+
+    valuator_mask_set_double(mask, x_axis, x);
+    valuator_mask_set_double(mask, y_axis, y);
+}
+
+/*
+ * Queue a Metrics gesture in the ring, dropping the oldest one when full.
+ */
+static void Gesture_Metrics_Push(GesturePtr rec,
+                                 const struct Gesture* gesture)
+{
+    const GestureMetrics* metrics = &gesture->details.metrics;
+    GestureMetricsRingPtr ring = rec->metrics;
+    GestureMetricsRec* record;
+    size_t tail;
+
+    if (ring->count == GESTURE_METRICS_RING_SIZE) {
+        ring->head = (ring->head + 1) % GESTURE_METRICS_RING_SIZE;
+        ring->count--;
+        ring->seq = (ring->seq + 1) % GESTURE_METRICS_SEQ_MOD;
+    }
+    tail = (ring->head + ring->count) % GESTURE_METRICS_RING_SIZE;
+    record = &ring->records[tail];
+    record->type = metrics->type;
+    record->data[0] = metrics->data[0];
+    record->data[1] = metrics->data[1];
+    record->time = gesture->end_time;
+    ring->count++;
+}
+
+GesturesPropBool
+Gesture_Metrics_Get(void* data)
+{
+    GesturePtr rec = data;
+    GestureMetricsRingPtr ring = rec->metrics;
+    InputInfoPtr info;
+    CmtDevicePtr cmt;
+    double* out = ring->buffer;
+    GestureMetricsRec* record;
+    stime_t now;
+    size_t i;
+
+    if (!rec->dev)
+        return FALSE;
+    info = rec->dev->public.devicePrivate;
+    cmt = info->private;
+    now = Gesture_Now(cmt->evdev.info.is_monotonic);
+
+    /* Without records, only the sequence number can have moved */
+    if (!ring->count && !out[0] && out[1] == ring->seq)
+        return FALSE;
+
+    /*
+     * Times are exported as the age of each record, which keeps them
+     * precise when converted to the 32 bit floats of the X property.
+     */
+    memset(out, 0, sizeof(ring->buffer));
+    *out++ = ring->count;
+    *out++ = ring->seq;
+    for (i = 0; i < ring->count; i++) {
+        record = &ring->records[(ring->head + i) % GESTURE_METRICS_RING_SIZE];
+        *out++ = record->type;
+        *out++ = record->data[0];
+        *out++ = record->data[1];
+        *out++ = now - record->time;
+    }
+    return TRUE;
+}
+
+void
+Gesture_Metrics_Ack(void* data)
+{
+    GesturePtr rec = data;
+    GestureMetricsRingPtr ring = rec->metrics;
+    size_t done;
+
+    /*
+     * The consumer writes the sequence number after the last record it
+     * has handled. Records dropped meanwhile, or an old value written
+     * again, leave nothing more to drop.
+     */
+    done = (unsigned)(ring->ack - ring->seq) % GESTURE_METRICS_SEQ_MOD;
+    if (done == 0 || done > ring->count)
+        return;
+    ring->head = (ring->head + done) % GESTURE_METRICS_RING_SIZE;
+    ring->count -= done;
+    ring->seq = ring->ack % GESTURE_METRICS_SEQ_MOD;
+}
+
+void
+Gesture_Stream_Set(void* data)
+{
+    GesturePtr rec = data;
+    InputInfoPtr info;
+    CmtDevicePtr cmt;
+    const char* dir;
+    char name[32];
+    int err;
+
+    if (!rec->dev)
+        return;
+    info = rec->dev->public.devicePrivate;
+    cmt = info->private;
+
+    if (!cmt->props.gesture_stream) {
+        GestureStream_Close(&rec->stream);
+        return;
     }
 
-    valuator_mask_set_double(mask, CMT_AXIS_ORDINAL_X, x);
-    valuator_mask_set_double(mask, CMT_AXIS_ORDINAL_Y, y);
+    dir = cmt->props.gesture_stream_dir ? cmt->props.gesture_stream_dir : "";
+    snprintf(name, sizeof(name), "cmt-gestures-%d", rec->dev->id);
+    err = GestureStream_Open(&rec->stream, dir, name);
+    if (err != Success) {
+        ERR(info, "Cannot create gesture stream: %s\n", strerror(err));
+        return;
+    }
+    xf86IDrvMsg(info, X_INFO, "Gesture stream at %s\n", rec->stream.path);
+}
+
+GesturesPropBool
+Gesture_Stream_Get_Location(void* data)
+{
+    GesturePtr rec = data;
+    GesturesPropBool changed = rec->stream.location_changed;
+
+    rec->stream.location_changed = FALSE;
+    return changed;
 }
 
 static void Gesture_Gesture_Ready(void* client_data,
@@ -380,7 +918,7 @@ static void Gesture_Gesture_Ready(void* client_data,
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
 
-    if (cmt->props.raw_passthrough) {
+    if (cmt->props.raw_passthrough && dev->touch) {
         DBG(info, "Gesture Suppressed");
         return;
     }
@@ -388,6 +926,10 @@ static void Gesture_Gesture_Ready(void* client_data,
     DBG(info, "Gesture Start: %f End: %f \n",
         gesture->start_time, gesture->end_time);
 
+    if (rec->stream.header)
+        GestureStream_Write(&rec->stream, gesture,
+                            Gesture_Now(cmt->evdev.info.is_monotonic));
+
     valuator_mask_zero(mask);
     switch (gesture->type) {
         case kGestureTypeContactInitiated:
@@ -397,31 +939,31 @@ static void Gesture_Gesture_Ready(void* client_data,
             const GestureMove* move = &gesture->details.move;
             DBG(info, "Gesture Move: (%f, %f) [%f, %f]\n",
                 move->dx, move->dy, move->ordinal_dx, move->ordinal_dy);
-            valuator_mask_set_double(mask, CMT_AXIS_X, move->dx);
-            valuator_mask_set_double(mask, CMT_AXIS_Y, move->dy);
+            SetAxis(cmt, mask, CMT_AXIS_X, move->dx);
+            SetAxis(cmt, mask, CMT_AXIS_Y, move->dy);
             SetTimeValues(mask, gesture, dev, FALSE);
             SetOrdinalValues(mask,
                              dev,
                              move->ordinal_dx,
                              move->ordinal_dy,
                              FALSE);
-            xf86PostMotionEventM(dev, FALSE, mask);
+            PostMotion(dev, FALSE, mask);
             break;
         }
         case kGestureTypeScroll: {
             const GestureScroll* scroll = &gesture->details.scroll;
             DBG(info, "Gesture Scroll: (%f, %f) [%f, %f]\n",
                 scroll->dx, scroll->dy, scroll->ordinal_dx, scroll->ordinal_dy);
-            valuator_mask_set_double(mask, CMT_AXIS_SCROLL_X, scroll->dx);
-            valuator_mask_set_double(mask, CMT_AXIS_SCROLL_Y, scroll->dy);
-            valuator_mask_set_double(mask, CMT_AXIS_FINGER_COUNT, 2.0);
+            SetAxis(cmt, mask, CMT_AXIS_SCROLL_X, scroll->dx);
+            SetAxis(cmt, mask, CMT_AXIS_SCROLL_Y, scroll->dy);
+            SetAxis(cmt, mask, CMT_AXIS_FINGER_COUNT, 2.0);
             SetTimeValues(mask, gesture, dev, TRUE);
             SetOrdinalValues(mask,
                              dev,
                              scroll->ordinal_dx,
                              scroll->ordinal_dy,
                              TRUE);
-            xf86PostMotionEventM(dev, FALSE, mask);
+            PostMotion(dev, FALSE, mask);
             break;
         }
         case kGestureTypeButtonsChange: {
@@ -456,42 +998,45 @@ static void Gesture_Gesture_Ready(void* client_data,
             DBG(info, "Gesture Fling: (%f, %f) [%f, %f] fling_state=%d\n",
                 fling->vx, fling->vy, fling->ordinal_vx, fling->ordinal_vy,
                 fling->fling_state);
-            valuator_mask_set_double(mask, CMT_AXIS_DBL_FLING_VX, fling->vx);
-            valuator_mask_set_double(mask, CMT_AXIS_DBL_FLING_VY, fling->vy);
-            valuator_mask_set(mask, CMT_AXIS_FLING_STATE, fling->fling_state);
+            SetAxis(cmt, mask, CMT_AXIS_DBL_FLING_VX, fling->vx);
+            SetAxis(cmt, mask, CMT_AXIS_DBL_FLING_VY, fling->vy);
+            SetAxis(cmt, mask, CMT_AXIS_FLING_STATE, fling->fling_state);
             SetTimeValues(mask, gesture, dev, TRUE);
             SetOrdinalValues(mask,
                              dev,
                              fling->ordinal_vx,
                              fling->ordinal_vy,
                              TRUE);
-            xf86PostMotionEventM(dev, TRUE, mask);
+            PostMotion(dev, TRUE, mask);
             break;
         }
         case kGestureTypeSwipe: {
             const GestureSwipe* swipe = &gesture->details.swipe;
             DBG(info, "Gesture Swipe: (%f, %f) [%f, %f]\n",
                 swipe->dx, swipe->dy, swipe->ordinal_dx, swipe->ordinal_dy);
-            valuator_mask_set_double(mask, CMT_AXIS_SCROLL_X, swipe->dx);
-            valuator_mask_set_double(mask, CMT_AXIS_SCROLL_Y, swipe->dy);
-            valuator_mask_set_double(mask, CMT_AXIS_FINGER_COUNT, 3.0);
+            /* Without the finger count a swipe would read as a scroll. */
+            if (cmt->axis_map[CMT_AXIS_FINGER_COUNT] < 0)
+                break;
+            SetAxis(cmt, mask, CMT_AXIS_SCROLL_X, swipe->dx);
+            SetAxis(cmt, mask, CMT_AXIS_SCROLL_Y, swipe->dy);
+            SetAxis(cmt, mask, CMT_AXIS_FINGER_COUNT, 3.0);
             SetTimeValues(mask, gesture, dev, TRUE);
             SetOrdinalValues(mask,
                              dev,
                              swipe->ordinal_dx,
                              swipe->ordinal_dy,
                              TRUE);
-            xf86PostMotionEventM(dev, TRUE, mask);
+            PostMotion(dev, TRUE, mask);
             break;
         }
         case kGestureTypeSwipeLift:
             DBG(info, "Gesture Swipe Lift\n");
             // Turn a swipe lift into a fling start.
             SetTimeValues(mask, gesture, dev, TRUE);
-            valuator_mask_set_double(mask, CMT_AXIS_DBL_FLING_VX, 0);
-            valuator_mask_set_double(mask, CMT_AXIS_DBL_FLING_VY, 0);
-            valuator_mask_set(mask, CMT_AXIS_FLING_STATE, 0);
-            xf86PostMotionEventM(dev, TRUE, mask);
+            SetAxis(cmt, mask, CMT_AXIS_DBL_FLING_VX, 0);
+            SetAxis(cmt, mask, CMT_AXIS_DBL_FLING_VY, 0);
+            SetAxis(cmt, mask, CMT_AXIS_FLING_STATE, 0);
+            PostMotion(dev, TRUE, mask);
             break;
         case kGestureTypePinch: {
             const GesturePinch* pinch = &gesture->details.pinch;
@@ -503,13 +1048,17 @@ static void Gesture_Gesture_Ready(void* client_data,
             const GestureMetrics* metrics = &gesture->details.metrics;
             DBG(info, "Gesture Metrics: [%f, %f] type=%d\n",
                 metrics->data[0], metrics->data[1], metrics->type);
-            valuator_mask_set_double(mask, CMT_AXIS_METRICS_DATA1,
+            if (!cmt->props.metrics_valuators) {
+                Gesture_Metrics_Push(rec, gesture);
+                break;
+            }
+            SetAxis(cmt, mask, CMT_AXIS_METRICS_DATA1,
                 metrics->data[0]);
-            valuator_mask_set_double(mask, CMT_AXIS_METRICS_DATA2,
+            SetAxis(cmt, mask, CMT_AXIS_METRICS_DATA2,
                 metrics->data[1]);
-            valuator_mask_set(mask, CMT_AXIS_METRICS_TYPE, metrics->type);
+            SetAxis(cmt, mask, CMT_AXIS_METRICS_TYPE, metrics->type);
             SetTimeValues(mask, gesture, dev, TRUE);
-            xf86PostMotionEventM(dev, TRUE, mask);
+            PostMotion(dev, TRUE, mask);
             break;
         }
         default:
@@ -578,16 +1127,7 @@ Gesture_TimerCallback(OsTimerPtr timer,
     stime_t rc;
     CARD32 next_timeout = 0;
 
-    if (tm->is_monotonic) {
-      struct timespec ts;
-      clock_gettime(CLOCK_MONOTONIC, &ts);
-      now = StimeFromTimespec(&ts);
-    } else {
-      struct timeval tv;
-      gettimeofday(&tv, NULL);
-      now = StimeFromTimeval(&tv);
-    }
-
+    now = Gesture_Now(tm->is_monotonic);
     rc = tm->callback(now, tm->callback_data);
     if (rc >= 0.0) {
         next_timeout = rc * 1000.0;
@@ -598,6 +1138,23 @@ Gesture_TimerCallback(OsTimerPtr timer,
     return next_timeout;
 }
 
+/*
+ * Current time in the same clock as the evdev event timestamps.
+ */
+static stime_t
+Gesture_Now(int is_monotonic)
+{
+    if (is_monotonic) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return StimeFromTimespec(&ts);
+    } else {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return StimeFromTimeval(&tv);
+    }
+}
+
 static enum GestureInterpreterDeviceClass
 Gesture_Device_Class(EvdevClass cls) {
   switch (cls) {
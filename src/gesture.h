@@ -8,6 +8,8 @@
 #ifndef _GESTURE_H_
 #define _GESTURE_H_
 
+#include <pthread.h>
+
 #include <gestures/gestures.h>
 
 #include <xorg-server.h>
@@ -15,23 +17,96 @@
 #include <xf86Xinput.h>
 
 #include "libevdevc/libevdevc.h"
+#include "gesture_stream.h"
+#include "frame_timing.h"
 #include "properties.h"
 
+/* Number of Metrics gestures buffered until the consumer acknowledges them */
+#define GESTURE_METRICS_RING_SIZE 64
+
+/* Values exported per buffered record: type, data[0], data[1], age */
+#define GESTURE_METRICS_RECORD_LEN 4
+
+/* Values ahead of the records: record count, sequence number of the first */
+#define GESTURE_METRICS_HEADER_LEN 2
+
+/* Size of the exported metrics property */
+#define GESTURE_METRICS_BUFFER_LEN \
+    (GESTURE_METRICS_HEADER_LEN + \
+     GESTURE_METRICS_RING_SIZE * GESTURE_METRICS_RECORD_LEN)
+
+/* Sequence numbers wrap here, so they stay exact in a 32 bit float */
+#define GESTURE_METRICS_SEQ_MOD (1 << 24)
+
 enum SLOT_STATUS {
     SLOT_STATUS_FREE = 0,
     SLOT_STATUS_RAW,
-    SLOT_STATUS_GESTURE
+    SLOT_STATUS_GESTURE,
+    SLOT_STATUS_PEN
 };
 
 typedef struct {
+    int type;
+    float data[2];
+    stime_t time;
+} GestureMetricsRec;
+
+/*
+ * Metrics gestures waiting to be read through the metrics property. Only
+ * touched when a Metrics gesture arrives or a client reads or acknowledges
+ * them, so it lives on the heap, away from the per-frame state.
+ */
+typedef struct {
+    GestureMetricsRec records[GESTURE_METRICS_RING_SIZE];
+    size_t head;
+    size_t count;
+    int seq;           /* Sequence number of the record at head */
+    int ack;           /* "Metrics Ack" storage */
+    double buffer[GESTURE_METRICS_BUFFER_LEN];  /* "Metrics" storage */
+} GestureMetricsRingRec, *GestureMetricsRingPtr;
+
+/*
+ * Pen axes outside the MT slots, followed in the event stream since the
+ * kernel only sends them when they change.
+ */
+typedef struct {
+    int x;          /* ABS_X, ABS_Y and ABS_PRESSURE of BTN_TOOL_PEN pens */
+    int y;
+    int pressure;
+    int tilt_x;
+    int tilt_y;
+    Bool in_prox;   /* BTN_TOOL_PEN was set in the last frame */
+} GesturePenRec;
+
+typedef struct {
+    /*
+     * Per-frame state, in one cache line aligned arena allocated by
+     * Gesture_Init and sized from the slot count.
+     */
+    void* arena;
+    unsigned long* prev_key_state;  /* Key bits of the last frame */
+    int *slot_states;  /* Leep track of slot usage between syn reports */
+    struct FingerState *fingers;
+    size_t max_fingers;
+    ValuatorMask *mask;  /* Valuators of the events being posted */
+
     GestureInterpreter* interpreter;  /* The interpreter from Gestures lib */
+    pthread_t construct_thread;  /* Builds the interpreter after PreInit */
+    Bool constructing;           /* Until Gesture_Wait joins it */
     DeviceIntPtr dev;
-    struct FingerState *fingers;
-    ValuatorMask *mask;
-    int *slot_states;  /* Leep track of slot usage between syn reports */
+    Bool pen_down;     /* Pen tip is touching the surface */
+    GesturePenRec pen;
+
+    GestureMetricsRingPtr metrics;  /* Allocated by Gesture_Init */
+    GestureStreamRec stream;  /* Optional shared memory copy of gestures */
+    FrameTimingRec timing;    /* Frame times, from hardware if possible */
 } GestureRec, *GesturePtr;
 
-int Gesture_Init(GesturePtr, size_t);
+/*
+ * Allocate per-device gesture state. Without an interpreter, the device can
+ * only send raw touches.
+ */
+int Gesture_Init(GesturePtr, size_t, Bool);
 void Gesture_Free(GesturePtr);
 
 /*
@@ -39,6 +114,12 @@ void Gesture_Free(GesturePtr);
  */
 void Gesture_Device_Init(GesturePtr, DeviceIntPtr);
 
+/*
+ * Set handler of "Touchscreen Gestures": builds the interpreter of a direct
+ * touch device the first time gestures are enabled.
+ */
+void Gesture_Interpreter_Set(void*);
+
 /*
  * Start performing gestures
  */
@@ -60,4 +141,21 @@ void Gesture_Device_Close(GesturePtr);
  */
 void Gesture_Process_Slots(void*, EventStatePtr, struct timeval*);
 
+/*
+ * Property handlers for the buffered Metrics gestures: the get handler
+ * copies them into the ring's buffer and leaves them buffered, the set
+ * handler of the acknowledgement drops the ones before the acknowledged
+ * sequence number.
+ */
+GesturesPropBool Gesture_Metrics_Get(void*);
+void Gesture_Metrics_Ack(void*);
+
+/*
+ * Property handlers for the shared memory gesture stream: opens, moves or
+ * closes it after the enable or directory property changed, and reports
+ * location changes.
+ */
+void Gesture_Stream_Set(void*);
+GesturesPropBool Gesture_Stream_Get_Location(void*);
+
 #endif
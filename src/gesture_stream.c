@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "gesture_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static char empty_location[] = "";
+
+void
+GestureStream_Init(GestureStreamPtr stream)
+{
+    stream->fd = -1;
+    stream->dir_fd = -1;
+    stream->header = NULL;
+    stream->records = NULL;
+    stream->size = 0;
+    stream->path = NULL;
+    stream->name = NULL;
+    stream->location = empty_location;
+    stream->location_changed = FALSE;
+}
+
+int
+GestureStream_Open(GestureStreamPtr stream, const char* dir, const char* name)
+{
+    size_t size = sizeof(GestureStreamHeader) +
+                  GESTURE_STREAM_SIZE * sizeof(GestureStreamRecord);
+    void* map;
+    char* path;
+    size_t len;
+    int dir_fd;
+    int fd;
+    int err;
+
+    if (stream->fd >= 0)
+        return Success;
+    if (dir[0] != '/' || strchr(name, '/'))
+        return EINVAL;
+
+    len = strlen(dir) + strlen(name) + 2;
+    path = malloc(len);
+    if (!path)
+        return ENOMEM;
+    snprintf(path, len, "%s/%s", dir, name);
+
+    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd < 0) {
+        err = errno;
+        free(path);
+        return err;
+    }
+
+    /*
+     * A file left behind by an earlier server is replaced, not reused, so
+     * consumers never see it change size under them.
+     */
+    unlinkat(dir_fd, name, 0);
+    fd = openat(dir_fd, name,
+                O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        err = errno;
+        close(dir_fd);
+        free(path);
+        return err;
+    }
+    /* Not narrowed by the server's umask */
+    fchmod(fd, 0640);
+
+    if (ftruncate(fd, size) < 0)
+        goto Error;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto Error;
+
+    stream->fd = fd;
+    stream->dir_fd = dir_fd;
+    stream->size = size;
+    stream->header = map;
+    stream->records = (GestureStreamRecord*)(stream->header + 1);
+
+    /* The new file is zero filled, so only the header needs setting up */
+    stream->header->version = GESTURE_STREAM_VERSION;
+    stream->header->header_size = sizeof(GestureStreamHeader);
+    stream->header->record_size = sizeof(GestureStreamRecord);
+    stream->header->capacity = GESTURE_STREAM_SIZE;
+    __atomic_store_n(&stream->header->magic, GESTURE_STREAM_MAGIC,
+                     __ATOMIC_RELEASE);
+
+    stream->path = path;
+    stream->name = path + len - strlen(name) - 1;
+    stream->location = path;
+    stream->location_changed = TRUE;
+    return Success;
+
+Error:
+    err = errno;
+    close(fd);
+    unlinkat(dir_fd, name, 0);
+    close(dir_fd);
+    free(path);
+    return err;
+}
+
+void
+GestureStream_Close(GestureStreamPtr stream)
+{
+    if (stream->fd < 0)
+        return;
+
+    munmap(stream->header, stream->size);
+    close(stream->fd);
+    unlinkat(stream->dir_fd, stream->name, 0);
+    close(stream->dir_fd);
+    free(stream->path);
+    GestureStream_Init(stream);
+    stream->location_changed = TRUE;
+}
+
+void
+GestureStream_Write(GestureStreamPtr stream, const struct Gesture* gesture,
+                    stime_t time)
+{
+    GestureStreamRecord* record;
+    uint64_t n;
+
+    if (!stream->header)
+        return;
+
+    n = stream->header->write_seq;
+    record = &stream->records[n & (GESTURE_STREAM_SIZE - 1)];
+
+    __atomic_store_n(&record->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->time = time;
+    record->gesture = *gesture;
+    __atomic_store_n(&record->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&stream->header->write_seq, n + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GESTURE_STREAM_H_
+#define _GESTURE_STREAM_H_
+
+#include <stdint.h>
+
+#include <gestures/gestures.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+/*
+ * Shared memory side channel carrying every gesture of a device to a trusted
+ * local consumer, next to the regular X events.
+ *
+ * The stream is a file in a directory the consumer can reach, normally on
+ * a tmpfs such as /run, that only the config sets. It holds a
+ * GestureStreamHeader followed by a ring of GESTURE_STREAM_SIZE records, in
+ * native byte order. It is created mode 0640, so a setgid directory of the
+ * consumer's group grants it access.
+ * The driver is the only writer. Each record carries a sequence lock: seq
+ * is odd while the record is written and 2 * (n + 1) once record n is
+ * complete. A reader copies a record between two reads of seq and keeps it
+ * only if both reads returned the even value it expected. write_seq counts
+ * completed records.
+ */
+
+#define GESTURE_STREAM_MAGIC   0x47544d43  /* "CMTG" */
+#define GESTURE_STREAM_VERSION 1
+#define GESTURE_STREAM_SIZE    256         /* Records, power of two */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t reserved;
+    uint64_t write_seq;
+} GestureStreamHeader;
+
+typedef struct {
+    uint64_t seq;
+    stime_t time;  /* When the driver received the gesture */
+    struct Gesture gesture;
+} GestureStreamRecord;
+
+typedef struct {
+    int fd;
+    int dir_fd;         /* Directory the file was created in */
+    GestureStreamHeader* header;
+    GestureStreamRecord* records;
+    size_t size;
+    char* path;         /* Where a consumer opens the file */
+    const char* name;   /* File name within dir_fd, points into path */
+    const char* location;  /* Property storage, points at path or "" */
+    Bool location_changed;
+} GestureStreamRec, *GestureStreamPtr;
+
+void GestureStream_Init(GestureStreamPtr);
+
+/*
+ * Create the shared ring as file name in directory dir, which must be an
+ * absolute path and not a symbolic link. The file is created relative to
+ * the opened directory, so it stays where the directory was when opened.
+ * Returns Success or an errno value.
+ */
+int GestureStream_Open(GestureStreamPtr, const char* dir, const char* name);
+void GestureStream_Close(GestureStreamPtr);
+
+/*
+ * Append a gesture to the ring, if the stream is open.
+ */
+void GestureStream_Write(GestureStreamPtr, const struct Gesture*, stime_t);
+
+#endif
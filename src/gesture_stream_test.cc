@@ -0,0 +1,109 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "gesture_stream.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+class GestureStreamTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/gesture_stream_test.XXXXXX";
+
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    GestureStream_Init(&stream_);
+  }
+
+  virtual void TearDown() {
+    GestureStream_Close(&stream_);
+    std::string cmd = "rm -rf " + dir_;
+    system(cmd.c_str());
+  }
+
+  static bool Exists(const std::string& path) {
+    struct stat st;
+
+    return lstat(path.c_str(), &st) == 0;
+  }
+
+  std::string dir_;
+  GestureStreamRec stream_;
+};
+
+// The ring is a file of the given name in the directory, readable by the
+// directory's group, and gone once the stream is closed
+TEST_F(GestureStreamTest, CreatesFileInDirectory) {
+  std::string path = dir_ + "/cmt-gestures-7";
+  struct stat st;
+
+  ASSERT_EQ(Success, GestureStream_Open(&stream_, dir_.c_str(),
+                                        "cmt-gestures-7"));
+  EXPECT_EQ(path, stream_.path);
+  EXPECT_STREQ(stream_.path, stream_.location);
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  EXPECT_EQ(0640u, st.st_mode & 0777);
+  EXPECT_EQ(stream_.size, static_cast<size_t>(st.st_size));
+
+  GestureStream_Close(&stream_);
+  EXPECT_FALSE(Exists(path));
+  EXPECT_STREQ("", stream_.location);
+}
+
+// A symbolic link, or a path relative to the server's directory, is not
+// followed to a directory chosen by someone else
+TEST_F(GestureStreamTest, RejectsLinkedAndRelativeDirectories) {
+  std::string target = dir_ + "/target";
+  std::string link = dir_ + "/link";
+
+  ASSERT_EQ(0, mkdir(target.c_str(), 0755));
+  ASSERT_EQ(0, symlink(target.c_str(), link.c_str()));
+
+  EXPECT_NE(Success, GestureStream_Open(&stream_, link.c_str(), "g"));
+  EXPECT_FALSE(Exists(target + "/g"));
+  EXPECT_EQ(EINVAL, GestureStream_Open(&stream_, "tmp", "g"));
+  EXPECT_EQ(EINVAL, GestureStream_Open(&stream_, dir_.c_str(), "../g"));
+  EXPECT_EQ(-1, stream_.fd);
+}
+
+// The file is removed from the directory it was created in, even when
+// another directory has taken that path since
+TEST_F(GestureStreamTest, ClosesInOpenedDirectory) {
+  std::string first = dir_ + "/run";
+  std::string moved = dir_ + "/moved";
+  int fd;
+
+  ASSERT_EQ(0, mkdir(first.c_str(), 0755));
+  ASSERT_EQ(Success, GestureStream_Open(&stream_, first.c_str(), "g"));
+  ASSERT_EQ(0, rename(first.c_str(), moved.c_str()));
+  ASSERT_EQ(0, mkdir(first.c_str(), 0755));
+  fd = open((first + "/g").c_str(), O_WRONLY | O_CREAT, 0600);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  GestureStream_Close(&stream_);
+  EXPECT_FALSE(Exists(moved + "/g"));
+  EXPECT_TRUE(Exists(first + "/g"));
+}
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "linearity.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LINEARITY_MAX_POINTS (1 << 24)  /* Grid points over all axes */
+#define LINEARITY_MAX_FILE   (64 << 20)
+
+/* a * b, or 0 if it does not fit in a size_t */
+static size_t
+Linearity_Mul(size_t a, size_t b)
+{
+    if (b && a > SIZE_MAX / b)
+        return 0;
+    return a * b;
+}
+
+/*
+ * Grid points of a file, or 0 if there are more than LINEARITY_MAX_POINTS.
+ * The dimensions come from the file, so their product may not fit.
+ */
+static size_t
+Linearity_Points(const LinearityHeader* header)
+{
+    size_t points;
+
+    points = Linearity_Mul(Linearity_Mul(header->dim[0], header->dim[1]),
+                           header->dim[2]);
+    return points <= LINEARITY_MAX_POINTS ? points : 0;
+}
+
+/* Bytes of the x and y error arrays, or 0 if they do not fit */
+static size_t
+Linearity_Data_Size(size_t points)
+{
+    return Linearity_Mul(points, 2 * sizeof(double));
+}
+
+const char*
+Linearity_Validate(const void* data, size_t size)
+{
+    const LinearityHeader* header = data;
+    const double* err;
+    size_t points;
+    size_t data_size;
+    size_t i;
+    int axis;
+
+    if (size < sizeof(*header) || header->magic != LINEARITY_MAGIC)
+        return "not a correction file";
+    if (header->version != LINEARITY_VERSION)
+        return "unsupported version";
+    if (header->header_size < sizeof(*header) || header->header_size % 8 ||
+        header->header_size > size)
+        return "bad header size";
+    if (header->elem_type != LINEARITY_ELEM_F64)
+        return "unsupported element type";
+
+    for (axis = 0; axis < 3; axis++) {
+        /* Interpolation needs two points on every axis */
+        if (header->dim[axis] < 2 || header->dim[axis] > LINEARITY_MAX_POINTS)
+            return "bad grid dimensions";
+        if (!isfinite(header->origin[axis]) ||
+            !isfinite(header->spacing[axis]) || header->spacing[axis] <= 0)
+            return "bad grid spacing";
+    }
+    points = Linearity_Points(header);
+    data_size = Linearity_Data_Size(points);
+    if (!data_size)
+        return "bad grid dimensions";
+    if (size - header->header_size != data_size)
+        return "size does not match the grid";
+
+    err = (const double*)((const char*)data + header->header_size);
+    if (Linearity_Checksum(err, data_size) != header->checksum)
+        return "checksum mismatch";
+    for (i = 0; i < 2 * points; i++)
+        if (!isfinite(err[i]))
+            return "error values are not finite";
+
+    return NULL;
+}
+
+/*
+ * Read one axis of a headerless file: an int32 count and the grid
+ * positions, which must be evenly spaced.
+ */
+static const char*
+Linearity_Convert_Axis(const char** p, const char* end, uint32_t* dim,
+                       double* origin, double* spacing)
+{
+    int32_t count;
+    double pos;
+    double step;
+    int32_t i;
+
+    if (end - *p < (ptrdiff_t)sizeof(count))
+        return "truncated";
+    memcpy(&count, *p, sizeof(count));
+    *p += sizeof(count);
+    if (count < 2 || count > LINEARITY_MAX_POINTS ||
+        (size_t)(end - *p) < count * sizeof(double))
+        return "bad grid dimensions";
+
+    memcpy(origin, *p, sizeof(double));
+    memcpy(&pos, *p + (count - 1) * sizeof(double), sizeof(double));
+    step = (pos - *origin) / (count - 1);
+    if (!isfinite(step) || step <= 0)
+        return "bad grid spacing";
+    for (i = 0; i < count; i++) {
+        memcpy(&pos, *p + i * sizeof(double), sizeof(double));
+        if (fabs(pos - (*origin + i * step)) > 1e-6 * step)
+            return "grid is not evenly spaced";
+    }
+    *p += count * sizeof(double);
+    *dim = count;
+    *spacing = step;
+
+    return NULL;
+}
+
+const char*
+Linearity_Convert(const void* data, size_t size, void** out, size_t* out_size)
+{
+    const char* p = data;
+    const char* end = p + size;
+    LinearityHeader header;
+    double* err;
+    size_t points;
+    size_t data_size;
+    size_t i;
+    const char* why;
+    int axis;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LINEARITY_MAGIC;
+    header.version = LINEARITY_VERSION;
+    header.header_size = sizeof(header);
+    header.elem_type = LINEARITY_ELEM_F64;
+
+    for (axis = 0; axis < 3; axis++) {
+        why = Linearity_Convert_Axis(&p, end, &header.dim[axis],
+                                     &header.origin[axis],
+                                     &header.spacing[axis]);
+        if (why)
+            return why;
+    }
+    points = Linearity_Points(&header);
+    data_size = Linearity_Data_Size(points);
+    if (!data_size || (size_t)(end - p) != data_size)
+        return "size does not match the grid";
+
+    *out_size = sizeof(header) + data_size;
+    *out = malloc(*out_size);
+    if (!*out)
+        return "out of memory";
+
+    /* (x, y) pairs become one array of each */
+    err = (double*)((char*)*out + sizeof(header));
+    for (i = 0; i < points; i++) {
+        memcpy(&err[i], p + 2 * i * sizeof(double), sizeof(double));
+        memcpy(&err[points + i], p + (2 * i + 1) * sizeof(double),
+               sizeof(double));
+    }
+    header.checksum = Linearity_Checksum(err, data_size);
+    memcpy(*out, &header, sizeof(header));
+
+    return NULL;
+}
+
+#ifndef LINEARITY_NO_DRIVER
+
+/* Files in use, shared by all devices */
+static LinearityPtr linearity_files;
+
+/*
+ * Map the file, or read and convert it if it has no header.
+ */
+static const char*
+Linearity_Load(LinearityPtr lin, int fd, size_t size)
+{
+    uint32_t magic = 0;
+    const char* why;
+    void* data;
+    ssize_t len;
+    size_t done;
+
+    if (pread(fd, &magic, sizeof(magic), 0) < 0)
+        return strerror(errno);
+
+    if (magic == LINEARITY_MAGIC) {
+        lin->map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (lin->map == MAP_FAILED) {
+            lin->map = NULL;
+            return strerror(errno);
+        }
+        lin->map_size = size;
+        lin->mapped = TRUE;
+        return NULL;
+    }
+
+    data = malloc(size);
+    if (!data)
+        return "out of memory";
+    for (done = 0; done < size; done += len) {
+        len = pread(fd, (char*)data + done, size - done, done);
+        if (len <= 0) {
+            free(data);
+            return len ? strerror(errno) : "truncated";
+        }
+    }
+    why = Linearity_Convert(data, size, &lin->map, &lin->map_size);
+    free(data);
+
+    return why;
+}
+
+/*
+ * Single precision copy of the grid for Linearity_Correct, with the
+ * errors of a grid point next to each other.
+ */
+static const char*
+Linearity_Build_Table(LinearityPtr lin)
+{
+    const LinearityHeader* header = lin->header;
+    size_t points = Linearity_Points(header);
+    size_t i;
+    int axis;
+
+    lin->table = malloc(2 * points * sizeof(*lin->table));
+    if (!lin->table)
+        return "out of memory";
+    for (i = 0; i < points; i++) {
+        lin->table[2 * i] = lin->x_err[i];
+        lin->table[2 * i + 1] = lin->y_err[i];
+    }
+
+    for (axis = 0; axis < 3; axis++) {
+        lin->origin[axis] = header->origin[axis];
+        lin->inv_spacing[axis] = 1.0 / header->spacing[axis];
+        lin->last[axis] = header->dim[axis] - 1;
+        lin->last_cell[axis] = header->dim[axis] - 2;
+    }
+
+    return NULL;
+}
+
+static void
+Linearity_Unload(LinearityPtr lin)
+{
+    free(lin->table);
+    if (lin->mapped)
+        munmap(lin->map, lin->map_size);
+    else
+        free(lin->map);
+    free(lin);
+}
+
+LinearityPtr
+Linearity_Open(InputInfoPtr info, const char* path)
+{
+    LinearityPtr lin;
+    struct stat st;
+    const char* why;
+    size_t points;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        xf86IDrvMsg(info, X_ERROR, "Cannot open \"%s\": %s\n", path,
+                    strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        xf86IDrvMsg(info, X_ERROR, "Cannot stat \"%s\": %s\n", path,
+                    strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    /* A file that changed since it was mapped is loaded again */
+    for (lin = linearity_files; lin; lin = lin->next)
+        if (lin->st_dev == st.st_dev && lin->st_ino == st.st_ino &&
+            lin->st_size == st.st_size && lin->st_mtime_sec == st.st_mtime) {
+            close(fd);
+            lin->refcount++;
+            return lin;
+        }
+
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        st.st_size > LINEARITY_MAX_FILE) {
+        xf86IDrvMsg(info, X_ERROR, "Rejecting \"%s\": bad file size\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    lin = calloc(1, sizeof(*lin));
+    if (!lin) {
+        close(fd);
+        return NULL;
+    }
+    why = Linearity_Load(lin, fd, st.st_size);
+    close(fd);
+    if (!why)
+        why = Linearity_Validate(lin->map, lin->map_size);
+    if (!why) {
+        lin->header = lin->map;
+        lin->x_err = (const double*)((const char*)lin->map +
+                                     lin->header->header_size);
+        points = Linearity_Points(lin->header);
+        lin->y_err = lin->x_err + points;
+        why = Linearity_Build_Table(lin);
+    }
+    if (why) {
+        xf86IDrvMsg(info, X_ERROR, "Rejecting \"%s\": %s\n", path, why);
+        Linearity_Unload(lin);
+        return NULL;
+    }
+
+    lin->refcount = 1;
+    lin->st_dev = st.st_dev;
+    lin->st_ino = st.st_ino;
+    lin->st_size = st.st_size;
+    lin->st_mtime_sec = st.st_mtime;
+    lin->next = linearity_files;
+    linearity_files = lin;
+
+    xf86IDrvMsg(info, X_INFO, "Using %s correction data \"%s\", %ux%ux%u\n",
+                lin->mapped ? "mapped" : "converted", path,
+                lin->header->dim[0], lin->header->dim[1],
+                lin->header->dim[2]);
+
+    return lin;
+}
+
+void
+Linearity_Close(LinearityPtr lin)
+{
+    LinearityPtr* p;
+
+    if (!lin || --lin->refcount > 0)
+        return;
+
+    for (p = &linearity_files; *p; p = &(*p)->next)
+        if (*p == lin) {
+            *p = lin->next;
+            break;
+        }
+    Linearity_Unload(lin);
+}
+
+/*
+ * Grid coordinate of a position along one axis, clamped to the grid, and
+ * the cell it falls in.
+ */
+static inline float
+Linearity_Coord(LinearityPtr lin, int axis, float pos, int* cell)
+{
+    float c = (pos - lin->origin[axis]) * lin->inv_spacing[axis];
+    int i;
+
+    c = c < 0.0f ? 0.0f : c;
+    c = c > lin->last[axis] ? lin->last[axis] : c;
+    i = (int)c;
+    *cell = i < lin->last_cell[axis] ? i : lin->last_cell[axis];
+
+    return c - *cell;
+}
+
+void
+Linearity_Correct(LinearityPtr lin, float* x, float* y, const float* p, int n)
+{
+    const LinearityHeader* header = lin->header;
+    const size_t stride_y = header->dim[2];
+    const size_t stride_x = (size_t)header->dim[1] * stride_y;
+    const float* t;
+    size_t base[n];
+    float wx[n], wy[n], wp[n];
+    float e[2][4];
+    int cx, cy, cp;
+    int i, k;
+
+    /*
+     * Weights first, for all fingers at once: this loop has no branches
+     * and no table reads. The table reads, 8 corners of 2 errors each,
+     * follow in a second pass.
+     */
+    for (i = 0; i < n; i++) {
+        wx[i] = Linearity_Coord(lin, 0, x[i], &cx);
+        wy[i] = Linearity_Coord(lin, 1, y[i], &cy);
+        wp[i] = Linearity_Coord(lin, 2, p[i], &cp);
+        base[i] = 2 * (cx * stride_x + cy * stride_y + cp);
+    }
+
+    for (i = 0; i < n; i++) {
+        t = lin->table + base[i];
+
+        /* Along pressure, for the 4 (x, y) corners */
+        for (k = 0; k < 2; k++) {
+            e[k][0] = t[k] + wp[i] * (t[2 + k] - t[k]);
+            e[k][1] = t[2 * stride_y + k] + wp[i] *
+                      (t[2 * stride_y + 2 + k] - t[2 * stride_y + k]);
+            e[k][2] = t[2 * stride_x + k] + wp[i] *
+                      (t[2 * stride_x + 2 + k] - t[2 * stride_x + k]);
+            e[k][3] = t[2 * (stride_x + stride_y) + k] + wp[i] *
+                      (t[2 * (stride_x + stride_y) + 2 + k] -
+                       t[2 * (stride_x + stride_y) + k]);
+        }
+
+        /* Then along y and x */
+        for (k = 0; k < 2; k++) {
+            e[k][0] += wy[i] * (e[k][1] - e[k][0]);
+            e[k][2] += wy[i] * (e[k][3] - e[k][2]);
+            e[k][0] += wx[i] * (e[k][2] - e[k][0]);
+        }
+
+        x[i] -= e[0][0];
+        y[i] -= e[1][0];
+    }
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _LINEARITY_H_
+#define _LINEARITY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Non-linearity correction data, mapped read-only and shared by every
+ * device using the same file.
+ *
+ * A file holds a LinearityHeader followed by the position errors on a
+ * regular grid over x, y and pressure, in native byte order: all x errors,
+ * then all y errors. The error at grid point (ix, iy, ip) is element
+ * (ix * dim[1] + iy) * dim[2] + ip of each array. checksum is FNV-1a over
+ * the error arrays.
+ *
+ * The headerless files of older releases are still read; they are copied
+ * into this layout instead of being mapped. xorg-conf/convert-linearity.c
+ * converts them.
+ */
+
+#define LINEARITY_MAGIC   0x4c4d4d43  /* "CMML" */
+#define LINEARITY_VERSION 1
+
+enum {
+    LINEARITY_ELEM_F64 = 1  /* double */
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;  /* Offset of the data, multiple of 8 */
+    uint32_t elem_type;
+    uint32_t dim[3];       /* Grid points along x, y and pressure */
+    uint32_t checksum;
+    double origin[3];      /* First grid point */
+    double spacing[3];     /* Distance between grid points */
+} LinearityHeader;
+
+static inline uint32_t
+Linearity_Checksum(const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t hash = 2166136261u;
+
+    while (size--) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Check a file image, returning NULL if it is valid and otherwise why not.
+ */
+const char* Linearity_Validate(const void*, size_t);
+
+/*
+ * Build the image of a headerless file in malloc()ed memory. Returns NULL
+ * on success and otherwise why the data cannot be converted.
+ */
+const char* Linearity_Convert(const void*, size_t, void**, size_t*);
+
+/* The converter only needs the above */
+#ifndef LINEARITY_NO_DRIVER
+#include <xorg-server.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+
+/* Options of the gestures library naming and enabling the correction */
+#define LINEARITY_OPT_FILE   "Non-linearity correction data file"
+#define LINEARITY_OPT_ENABLE "Enable non-linearity correction"
+
+typedef struct LinearityRec {
+    struct LinearityRec* next;
+    int refcount;
+    dev_t st_dev;          /* Identity of the file it was read from */
+    ino_t st_ino;
+    off_t st_size;
+    time_t st_mtime_sec;
+    void* map;             /* Mapping, or the copy of a headerless file */
+    size_t map_size;
+    Bool mapped;
+    const LinearityHeader* header;
+    const double* x_err;
+    const double* y_err;
+
+    /* Interpolation tables, built once per file */
+    float* table;          /* (x, y) error pairs, in grid order */
+    float origin[3];
+    float inv_spacing[3];
+    float last[3];         /* Highest grid coordinate, dim - 1 */
+    int last_cell[3];      /* Highest cell, dim - 2 */
+} LinearityRec, *LinearityPtr;
+
+/*
+ * Map and validate a correction file, or take another reference to it if
+ * a device uses it already. Logs why a file is rejected and returns NULL.
+ */
+LinearityPtr Linearity_Open(InputInfoPtr, const char*);
+void Linearity_Close(LinearityPtr);
+
+/*
+ * Subtract the interpolated position error from n fingers, given as
+ * arrays of x, y and pressure. Points off the grid use its edge.
+ */
+void Linearity_Correct(LinearityPtr, float*, float*, const float*, int);
+#endif
+
+#endif
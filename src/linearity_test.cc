@@ -0,0 +1,216 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "linearity.h"
+#include "test_stubs.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+class LinearityTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    stub_reset();
+    memset(&info_, 0, sizeof(info_));
+    lin_ = NULL;
+    snprintf(path_, sizeof(path_), "/tmp/linearity_test.XXXXXX");
+  }
+
+  virtual void TearDown() {
+    Linearity_Close(lin_);
+    unlink(path_);
+  }
+
+  // Write a grid with pseudo random errors and open it
+  void Open(uint32_t nx, uint32_t ny, uint32_t np) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> err(-2.0, 2.0);
+    LinearityHeader header = LinearityHeader();
+    size_t points = static_cast<size_t>(nx) * ny * np;
+    int fd;
+
+    x_err_.resize(points);
+    y_err_.resize(points);
+    for (size_t i = 0; i < points; i++) {
+      x_err_[i] = err(gen);
+      y_err_[i] = err(gen);
+    }
+    std::vector<double> errors(x_err_);
+    errors.insert(errors.end(), y_err_.begin(), y_err_.end());
+
+    header.magic = LINEARITY_MAGIC;
+    header.version = LINEARITY_VERSION;
+    header.header_size = sizeof(header);
+    header.elem_type = LINEARITY_ELEM_F64;
+    header.dim[0] = nx;
+    header.dim[1] = ny;
+    header.dim[2] = np;
+    header.checksum = Linearity_Checksum(&errors[0],
+                                         errors.size() * sizeof(double));
+    header.origin[0] = 10.0;
+    header.origin[1] = -5.0;
+    header.origin[2] = 0.0;
+    header.spacing[0] = 20.0;
+    header.spacing[1] = 12.5;
+    header.spacing[2] = 32.0;
+    header_ = header;
+
+    fd = mkstemp(path_);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(header)),
+              write(fd, &header, sizeof(header)));
+    ASSERT_EQ(static_cast<ssize_t>(errors.size() * sizeof(double)),
+              write(fd, &errors[0], errors.size() * sizeof(double)));
+    close(fd);
+
+    lin_ = Linearity_Open(&info_, path_);
+    ASSERT_TRUE(lin_ != NULL) << stub_log;
+  }
+
+  // Trilinear interpolation of the error at a point, in double precision,
+  // clamped to the grid like the library does
+  void Reference(double x, double y, double p, double* ex, double* ey) {
+    double pos[3] = { x, y, p };
+    double w[3];
+    size_t cell[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+      double c = (pos[axis] - header_.origin[axis]) / header_.spacing[axis];
+      double last = header_.dim[axis] - 1;
+
+      c = fmin(fmax(c, 0.0), last);
+      cell[axis] = static_cast<size_t>(fmin(floor(c), last - 1));
+      w[axis] = c - cell[axis];
+    }
+
+    *ex = 0.0;
+    *ey = 0.0;
+    for (int corner = 0; corner < 8; corner++) {
+      size_t ix = cell[0] + (corner >> 2 & 1);
+      size_t iy = cell[1] + (corner >> 1 & 1);
+      size_t ip = cell[2] + (corner & 1);
+      size_t i = (ix * header_.dim[1] + iy) * header_.dim[2] + ip;
+      double weight = ((corner >> 2 & 1) ? w[0] : 1.0 - w[0]) *
+                      ((corner >> 1 & 1) ? w[1] : 1.0 - w[1]) *
+                      ((corner & 1) ? w[2] : 1.0 - w[2]);
+
+      *ex += weight * x_err_[i];
+      *ey += weight * y_err_[i];
+    }
+  }
+
+  InputInfoRec info_;
+  LinearityPtr lin_;
+  LinearityHeader header_;
+  std::vector<double> x_err_;
+  std::vector<double> y_err_;
+  char path_[64];
+};
+
+// The float tables give the errors of the double precision interpolation,
+// on the grid, between its points and off its edges
+TEST_F(LinearityTest, CorrectMatchesReference) {
+  const int kPoints = 4096;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> x(-20.0f, 250.0f);
+  std::uniform_real_distribution<float> y(-30.0f, 150.0f);
+  std::uniform_real_distribution<float> p(-10.0f, 300.0f);
+  std::vector<float> xs(kPoints), ys(kPoints), ps(kPoints);
+  double ex, ey;
+
+  Open(11, 9, 5);
+  for (int i = 0; i < kPoints; i++) {
+    xs[i] = x(gen);
+    ys[i] = y(gen);
+    ps[i] = p(gen);
+  }
+  // Grid points and the far corner
+  xs[0] = 10.0f;
+  ys[0] = -5.0f;
+  ps[0] = 0.0f;
+  xs[1] = 210.0f;
+  ys[1] = 95.0f;
+  ps[1] = 128.0f;
+
+  std::vector<float> cx(xs), cy(ys);
+  Linearity_Correct(lin_, &cx[0], &cy[0], &ps[0], kPoints);
+
+  for (int i = 0; i < kPoints; i++) {
+    Reference(xs[i], ys[i], ps[i], &ex, &ey);
+    EXPECT_NEAR(xs[i] - ex, cx[i], 1e-3) << "at " << i;
+    EXPECT_NEAR(ys[i] - ey, cy[i], 1e-3) << "at " << i;
+  }
+  EXPECT_NEAR(xs[0] - x_err_[0], cx[0], 1e-4);
+  EXPECT_NEAR(ys[1] - y_err_.back(), cy[1], 1e-4);
+}
+
+// Devices using one file share its mapping
+TEST_F(LinearityTest, SharedBetweenDevices) {
+  Open(3, 3, 2);
+  LinearityPtr other = Linearity_Open(&info_, path_);
+
+  EXPECT_EQ(lin_, other);
+  Linearity_Close(other);
+}
+
+TEST_F(LinearityTest, RejectsBadChecksum) {
+  Open(3, 3, 2);
+  FILE* fp = fopen(path_, "r+");
+
+  ASSERT_TRUE(fp != NULL);
+  fseek(fp, sizeof(LinearityHeader), SEEK_SET);
+  fputc(0x55, fp);
+  fclose(fp);
+  // Once no device uses it, the file is read and checked again
+  Linearity_Close(lin_);
+  lin_ = NULL;
+  stub_log[0] = '\0';
+  EXPECT_EQ(NULL, Linearity_Open(&info_, path_));
+  EXPECT_TRUE(strstr(stub_log, "Rejecting") != NULL) << stub_log;
+}
+
+// Grid dimensions whose product wraps around in a size_t must not pass as
+// a small grid, or the data would be indexed past the end of the file
+TEST_F(LinearityTest, RejectsOverflowingDimensions) {
+  const uint32_t dims[][3] = {
+    { 1 << 24, 1 << 24, 1 << 24 },  // 2^72
+    { 1 << 22, 1 << 21, 1 << 21 },  // 2^64
+    { 1 << 24, 1 << 24, 2 },        // Past the point limit
+  };
+  LinearityHeader header = LinearityHeader();
+  double none = 0.0;
+
+  header.magic = LINEARITY_MAGIC;
+  header.version = LINEARITY_VERSION;
+  header.header_size = sizeof(header);
+  header.elem_type = LINEARITY_ELEM_F64;
+  header.checksum = Linearity_Checksum(&none, 0);
+  for (int axis = 0; axis < 3; axis++)
+    header.spacing[axis] = 1.0;
+
+  for (const auto& dim : dims) {
+    memcpy(header.dim, dim, sizeof(header.dim));
+    EXPECT_STREQ("bad grid dimensions",
+                 Linearity_Validate(&header, sizeof(header)));
+  }
+}
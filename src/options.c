@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "options.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTION_INDEX_MIN_SIZE 16  /* Power of two */
+
+static char* OptionIndex_Key(const char*);
+static size_t OptionIndex_Hash(const char*);
+static int OptionIndex_Grow(OptionIndexPtr);
+static int OptionIndex_Insert(OptionIndexPtr, const char*, XF86OptionPtr,
+                              const BoardOption*);
+static OptionEntry* OptionIndex_Lookup(OptionIndexPtr, const char*);
+static OptionEntry* OptionIndex_Find(OptionIndexPtr, const char*);
+static const char* OptionIndex_Value(OptionEntry*);
+static void OptionIndex_Log(OptionEntry*);
+static Bool OptionIndex_Match(const char*, const char*, Bool);
+
+/*
+ * Lower case copy of an option name without spaces, tabs and underscores,
+ * matching what xf86nameCompare ignores.
+ */
+static char*
+OptionIndex_Key(const char* name)
+{
+    char* key = malloc(strlen(name) + 1);
+    char* p = key;
+
+    if (!key)
+        return NULL;
+
+    for (; *name; name++)
+        if (*name != ' ' && *name != '\t' && *name != '_')
+            *p++ = tolower((unsigned char)*name);
+    *p = '\0';
+
+    return key;
+}
+
+static size_t
+OptionIndex_Hash(const char* key)
+{
+    uint32_t hash = 2166136261u;  /* FNV-1a */
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int
+OptionIndex_Grow(OptionIndexPtr index)
+{
+    OptionEntry* old = index->table;
+    size_t old_size = index->size;
+    size_t size = old_size ? old_size * 2 : OPTION_INDEX_MIN_SIZE;
+    size_t i, j;
+
+    index->table = calloc(size, sizeof(*index->table));
+    if (!index->table) {
+        index->table = old;
+        return BadAlloc;
+    }
+    index->size = size;
+
+    for (i = 0; i < old_size; i++) {
+        if (!old[i].key)
+            continue;
+        for (j = OptionIndex_Hash(old[i].key) & (size - 1);
+             index->table[j].key; j = (j + 1) & (size - 1))
+            continue;
+        index->table[j] = old[i];
+    }
+    free(old);
+
+    return Success;
+}
+
+/*
+ * Add an entry unless the name is indexed already; the first one wins.
+ */
+static int
+OptionIndex_Insert(OptionIndexPtr index, const char* name, XF86OptionPtr opt,
+                   const BoardOption* deflt)
+{
+    size_t mask;
+    size_t i;
+    char* key;
+
+    if ((index->used + 1) * 2 > index->size &&
+        OptionIndex_Grow(index) != Success)
+        return BadAlloc;
+
+    key = OptionIndex_Key(name);
+    if (!key)
+        return BadAlloc;
+
+    mask = index->size - 1;
+    for (i = OptionIndex_Hash(key) & mask; index->table[i].key;
+         i = (i + 1) & mask)
+        if (!strcmp(index->table[i].key, key)) {
+            /* Remember the board default a config option overrides */
+            if (!index->table[i].deflt)
+                index->table[i].deflt = deflt;
+            free(key);
+            return Success;
+        }
+
+    index->table[i].key = key;
+    index->table[i].opt = opt;
+    index->table[i].deflt = deflt;
+    index->used++;
+
+    return Success;
+}
+
+int
+OptionIndex_Init(OptionIndexPtr index, XF86OptionPtr options)
+{
+    XF86OptionPtr opt;
+
+    index->table = NULL;
+    index->size = 0;
+    index->used = 0;
+    index->reported = FALSE;
+
+    /* The server also uses the first of several options with one name */
+    for (opt = xf86FirstOption(options); opt; opt = xf86NextOption(opt))
+        if (OptionIndex_Insert(index, xf86OptionName(opt), opt, NULL) !=
+            Success) {
+            OptionIndex_Free(index);
+            return BadAlloc;
+        }
+
+    /* Keep an empty option list distinct from having no index */
+    if (!index->size && OptionIndex_Grow(index) != Success)
+        return BadAlloc;
+
+    return Success;
+}
+
+void
+OptionIndex_Free(OptionIndexPtr index)
+{
+    size_t i;
+
+    for (i = 0; i < index->size; i++)
+        free(index->table[i].key);
+    free(index->table);
+    index->table = NULL;
+    index->size = 0;
+    index->used = 0;
+}
+
+/*
+ * Match a value against '|' separated patterns, as substrings or as shell
+ * globs.
+ */
+static Bool
+OptionIndex_Match(const char* patterns, const char* value, Bool glob)
+{
+    char pattern[256];
+    const char* end;
+    size_t len;
+
+    if (!patterns)
+        return TRUE;
+    if (!value)
+        return FALSE;
+
+    for (;;) {
+        end = strchr(patterns, '|');
+        len = end ? (size_t)(end - patterns) : strlen(patterns);
+        if (len < sizeof(pattern)) {
+            memcpy(pattern, patterns, len);
+            pattern[len] = '\0';
+            if (glob ? !fnmatch(pattern, value, 0) : !!strstr(value, pattern))
+                return TRUE;
+        }
+        if (!end)
+            return FALSE;
+        patterns = end + 1;
+    }
+}
+
+Bool
+OptionIndex_Section_Matches(const BoardSection* section, const char* board,
+                            unsigned type, const char* product,
+                            const char* usbid, const char* path)
+{
+    if (section->board[0] && (!board || strcmp(section->board, board)))
+        return FALSE;
+
+    return (section->match_type & type) == section->match_type &&
+           !(section->match_not_type & type) &&
+           OptionIndex_Match(section->match_product, product, FALSE) &&
+           OptionIndex_Match(section->match_usbid, usbid, TRUE) &&
+           OptionIndex_Match(section->match_path, path, TRUE);
+}
+
+void
+OptionIndex_Add_Board(OptionIndexPtr index, const char* board, unsigned type,
+                      const char* product, unsigned vendor_id,
+                      unsigned product_id, const char* path)
+{
+    const BoardSection* section;
+    char usbid[16];
+    size_t i, j;
+
+    if (!index->size)
+        return;
+
+    snprintf(usbid, sizeof(usbid), "%04x:%04x", vendor_id, product_id);
+
+    /* Walk backwards, so the last matching section sets each option */
+    for (i = board_num_sections; i-- > 0;) {
+        section = &board_sections[i];
+        if (!OptionIndex_Section_Matches(section, board, type, product, usbid,
+                                         path))
+            continue;
+        for (j = section->num_options; j-- > 0;)
+            if (OptionIndex_Insert(index, section->options[j].name, NULL,
+                                   &section->options[j]) != Success)
+                return;
+    }
+}
+
+/*
+ * The entry of an option, without marking it used.
+ */
+static OptionEntry*
+OptionIndex_Lookup(OptionIndexPtr index, const char* name)
+{
+    OptionEntry* entry = NULL;
+    size_t mask = index->size - 1;
+    size_t i;
+    char* key;
+
+    key = OptionIndex_Key(name);
+    if (!key)
+        return NULL;
+
+    for (i = OptionIndex_Hash(key) & mask; index->table[i].key;
+         i = (i + 1) & mask)
+        if (!strcmp(index->table[i].key, key)) {
+            entry = &index->table[i];
+            break;
+        }
+    free(key);
+
+    return entry;
+}
+
+static OptionEntry*
+OptionIndex_Find(OptionIndexPtr index, const char* name)
+{
+    OptionEntry* entry = OptionIndex_Lookup(index, name);
+
+    if (entry && entry->opt)
+        xf86MarkOptionUsed(entry->opt);
+    if (entry && !entry->logged) {
+        OptionIndex_Log(entry);
+        entry->logged = TRUE;
+    }
+
+    return entry;
+}
+
+/*
+ * Value of an entry as the config spelled it.
+ */
+static const char*
+OptionIndex_Value(OptionEntry* entry)
+{
+    return entry->opt ? xf86OptionValue(entry->opt) : entry->deflt->value;
+}
+
+/*
+ * Log an option the way xf86Set*Option do; board defaults are marked as
+ * defaults.
+ */
+static void
+OptionIndex_Log(OptionEntry* entry)
+{
+    const char* name = entry->opt ? xf86OptionName(entry->opt) :
+                                    entry->deflt->name;
+    const char* value = OptionIndex_Value(entry);
+    MessageType type = entry->opt ? X_CONFIG : X_DEFAULT;
+
+    if (value)
+        xf86Msg(type, "Option \"%s\" \"%s\"\n", name, value);
+    else
+        xf86Msg(type, "Option \"%s\"\n", name);
+}
+
+int
+OptionIndex_Int(OptionIndexPtr index, XF86OptionPtr options,
+                const char* name, int deflt)
+{
+    OptionEntry* entry;
+    const char* str;
+    char* end;
+    long val;
+
+    if (!index->size)
+        return xf86SetIntOption(options, name, deflt);
+
+    entry = OptionIndex_Find(index, name);
+    if (!entry)
+        return deflt;
+    if (!entry->opt && entry->deflt->type == BOARD_VALUE_INT)
+        return entry->deflt->number;
+
+    str = OptionIndex_Value(entry);
+    val = strtol(str ? str : "", &end, 0);
+    if (!str || end == str || *end) {
+        xf86Msg(X_ERROR, "Option \"%s\" requires an integer value\n", name);
+        return deflt;
+    }
+
+    return val;
+}
+
+Bool
+OptionIndex_Bool(OptionIndexPtr index, XF86OptionPtr options,
+                 const char* name, Bool deflt)
+{
+    OptionEntry* entry;
+    const char* str;
+    Bool val;
+
+    if (!index->size)
+        return xf86SetBoolOption(options, name, deflt);
+
+    entry = OptionIndex_Find(index, name);
+    if (!entry)
+        return deflt;
+    if (!entry->opt && entry->deflt->type == BOARD_VALUE_BOOL)
+        return entry->deflt->number != 0;
+
+    /* An option without a value is a set boolean */
+    str = OptionIndex_Value(entry);
+    if (!str || !*str)
+        return TRUE;
+    if (!xf86getBoolValue(&val, str)) {
+        xf86Msg(X_ERROR, "Option \"%s\" requires a boolean value\n", name);
+        return deflt;
+    }
+
+    return val;
+}
+
+double
+OptionIndex_Real(OptionIndexPtr index, XF86OptionPtr options,
+                 const char* name, double deflt)
+{
+    OptionEntry* entry;
+    const char* str;
+    char* end;
+    double val;
+
+    if (!index->size)
+        return xf86SetRealOption(options, name, deflt);
+
+    entry = OptionIndex_Find(index, name);
+    if (!entry)
+        return deflt;
+    if (!entry->opt && (entry->deflt->type == BOARD_VALUE_REAL ||
+                        entry->deflt->type == BOARD_VALUE_INT))
+        return entry->deflt->number;
+
+    str = OptionIndex_Value(entry);
+    val = strtod(str ? str : "", &end);
+    if (!str || end == str || *end) {
+        xf86Msg(X_ERROR, "Option \"%s\" requires a floating point value\n",
+                name);
+        return deflt;
+    }
+
+    return val;
+}
+
+char*
+OptionIndex_Str(OptionIndexPtr index, XF86OptionPtr options,
+                const char* name, const char* deflt)
+{
+    OptionEntry* entry;
+    const char* str = deflt;
+
+    if (!index->size)
+        return xf86SetStrOption(options, name, deflt);
+
+    entry = OptionIndex_Find(index, name);
+    if (entry && OptionIndex_Value(entry))
+        str = OptionIndex_Value(entry);
+
+    return str ? strdup(str) : NULL;
+}
+
+Bool
+OptionIndex_Is_Set(OptionIndexPtr index, XF86OptionPtr options,
+                   const char* name)
+{
+    OptionEntry* entry;
+    const char* value;
+    double number;
+    char* end;
+    Bool flag;
+
+    if (!index->size)
+        return xf86FindOption(options, name) != NULL;
+
+    entry = OptionIndex_Find(index, name);
+    if (!entry || !entry->opt)
+        return FALSE;
+    if (!entry->deflt)
+        return TRUE;
+
+    /* Set to the shipped default, which is as good as not set */
+    value = xf86OptionValue(entry->opt);
+    if (!value)
+        value = "";
+    switch (entry->deflt->type) {
+    case BOARD_VALUE_STRING:
+        return strcmp(value, entry->deflt->value) != 0;
+    case BOARD_VALUE_BOOL:
+        if (!*value)
+            flag = TRUE;
+        else if (!xf86getBoolValue(&flag, value))
+            return TRUE;
+        return flag != (entry->deflt->number != 0);
+    default:
+        number = strtod(value, &end);
+        return end == value || *end || number != entry->deflt->number;
+    }
+}
+
+void
+OptionIndex_Replace_Bool(OptionIndexPtr index, XF86OptionPtr* options,
+                         const char* name, Bool value)
+{
+    OptionEntry* entry;
+
+    *options = xf86ReplaceBoolOption(*options, name, value);
+    if (!index->size)
+        return;
+
+    /* A new option, or one hiding a board default, needs the index too */
+    if (OptionIndex_Insert(index, name, NULL, NULL) != Success)
+        return;
+    entry = OptionIndex_Lookup(index, name);
+    if (entry) {
+        entry->opt = xf86FindOption(*options, name);
+        entry->logged = FALSE;
+    }
+}
+
+void
+OptionIndex_Report_Unused(OptionIndexPtr index, InputInfoPtr info)
+{
+    size_t i;
+
+    if (index->reported)
+        return;
+    index->reported = TRUE;
+
+    for (i = 0; i < index->size; i++) {
+        if (!index->table[i].opt ||
+            xf86CheckIfOptionUsed(index->table[i].opt))
+            continue;
+        /* Options starting with '_' are set by the server itself */
+        if (xf86OptionName(index->table[i].opt)[0] == '_')
+            continue;
+        xf86IDrvMsg(info, X_INFO, "Option \"%s\" is not used\n",
+                    xf86OptionName(index->table[i].opt));
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+
+#include "board_table.h"
+
+/*
+ * Hashed index of a device's options, built in one pass over the option
+ * list. Names are matched like the server does: ignoring case, spaces and
+ * underscores. Options found through the index are marked as used.
+ *
+ * Compiled in board defaults can be added below the options; an option
+ * set in the config always wins over them.
+ */
+
+typedef struct {
+    char* key;          /* Normalised name */
+    XF86OptionPtr opt;  /* Option from the config, or NULL */
+    const BoardOption* deflt;  /* Board default, used when opt is NULL */
+    Bool logged;        /* Looked up before */
+} OptionEntry;
+
+typedef struct {
+    OptionEntry* table;
+    size_t size;        /* Power of two, zero when there is no index */
+    size_t used;
+    Bool reported;      /* Unused options were logged */
+} OptionIndexRec, *OptionIndexPtr;
+
+int OptionIndex_Init(OptionIndexPtr, XF86OptionPtr);
+void OptionIndex_Free(OptionIndexPtr);
+
+/*
+ * Add the defaults of the board table sections matching a device. board
+ * is the board name, or NULL for the sections common to all boards only.
+ * Later sections win over earlier ones, as with InputClass.
+ */
+void OptionIndex_Add_Board(OptionIndexPtr, const char* board, unsigned type,
+                           const char* product, unsigned vendor_id,
+                           unsigned product_id, const char* path);
+
+/*
+ * Whether a section applies to a device, see OptionIndex_Add_Board. usbid
+ * is in "vvvv:pppp" form.
+ */
+Bool OptionIndex_Section_Matches(const BoardSection*, const char* board,
+                                 unsigned type, const char* product,
+                                 const char* usbid, const char* path);
+
+/*
+ * Typed lookups. Without an index, these fall back to xf86Set*Option. The
+ * first lookup of an option logs its value, like the server does.
+ * OptionIndex_Str returns a copy for the caller to free, as
+ * xf86SetStrOption does.
+ */
+int OptionIndex_Int(OptionIndexPtr, XF86OptionPtr, const char*, int);
+Bool OptionIndex_Bool(OptionIndexPtr, XF86OptionPtr, const char*, Bool);
+double OptionIndex_Real(OptionIndexPtr, XF86OptionPtr, const char*, double);
+char* OptionIndex_Str(OptionIndexPtr, XF86OptionPtr, const char*,
+                      const char*);
+
+/*
+ * Whether the config sets an option, as opposed to a board default. An
+ * option set to the value of the board default, as the shipped configs
+ * do, counts as not set, so that a value derived at run time can still
+ * replace it.
+ */
+Bool OptionIndex_Is_Set(OptionIndexPtr, XF86OptionPtr, const char*);
+
+/*
+ * Set a boolean option in the option list, and in the index, where it
+ * wins over a board default like any config option.
+ */
+void OptionIndex_Replace_Bool(OptionIndexPtr, XF86OptionPtr*, const char*,
+                              Bool);
+
+/*
+ * Log the options no one has consumed so far. The server reads some of
+ * them, such as the acceleration options, only after the device is
+ * initialised, so this is best left until the device is first enabled.
+ * Only the first call logs anything.
+ */
+void OptionIndex_Report_Unused(OptionIndexPtr, InputInfoPtr);
+
+#endif
@@ -0,0 +1,200 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "options.h"
+#include "test_stubs.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+class OptionIndexTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    stub_reset();
+    options_ = NULL;
+    index_.size = 0;
+  }
+
+  virtual void TearDown() {
+    OptionIndex_Free(&index_);
+    stub_free_options(options_);
+  }
+
+  void Add(const char* name, const char* value) {
+    options_ = stub_add_option(options_, name, value);
+  }
+
+  void Index() {
+    ASSERT_EQ(Success, OptionIndex_Init(&index_, options_));
+  }
+
+  XF86OptionPtr options_;
+  OptionIndexRec index_;
+};
+
+// Names match like xf86NameCmp: case, spaces, tabs and underscores do not
+// count.
+TEST_F(OptionIndexTest, NormalisesNames) {
+  Add("Tap_Minimum Pressure", "25");
+  Add("palm\tWIDTH", "7.5");
+  Index();
+
+  EXPECT_EQ(25, OptionIndex_Int(&index_, options_, "Tap Minimum Pressure",
+                                0));
+  EXPECT_EQ(25, OptionIndex_Int(&index_, options_, "tapminimumpressure", 0));
+  EXPECT_EQ(7.5, OptionIndex_Real(&index_, options_, "Palm Width", 0.0));
+  EXPECT_EQ(3, OptionIndex_Int(&index_, options_, "Tap Minimum", 3));
+}
+
+// As with the server, the first of several options with one name is used
+TEST_F(OptionIndexTest, FirstOptionWins) {
+  Add("Pressure Calibration Offset", "1");
+  Add("Pressure_Calibration_Offset", "2");
+  Index();
+
+  EXPECT_EQ(1, OptionIndex_Int(&index_, options_,
+                               "Pressure Calibration Offset", 0));
+}
+
+// Values that do not parse leave the default
+TEST_F(OptionIndexTest, ParsesTypedValues) {
+  Add("Int", "0x10");
+  Add("Bad Int", "ten");
+  Add("Bool", "off");
+  Add("Bare Bool", NULL);
+  Add("Bad Bool", "maybe");
+  Add("Real", "0.25");
+  Index();
+
+  EXPECT_EQ(16, OptionIndex_Int(&index_, options_, "Int", 0));
+  EXPECT_EQ(4, OptionIndex_Int(&index_, options_, "Bad Int", 4));
+  EXPECT_FALSE(OptionIndex_Bool(&index_, options_, "Bool", TRUE));
+  EXPECT_TRUE(OptionIndex_Bool(&index_, options_, "Bare Bool", FALSE));
+  EXPECT_FALSE(OptionIndex_Bool(&index_, options_, "Bad Bool", FALSE));
+  EXPECT_EQ(0.25, OptionIndex_Real(&index_, options_, "Real", 0.0));
+}
+
+// Strings are copies for the caller, with or without an index
+TEST_F(OptionIndexTest, StringsAreCopies) {
+  const char* deflt = "default";
+  char* str;
+
+  Add("Board", "link");
+  Index();
+
+  str = OptionIndex_Str(&index_, options_, "board", NULL);
+  ASSERT_TRUE(str != NULL);
+  EXPECT_STREQ("link", str);
+  EXPECT_NE(xf86OptionValue(options_), str);
+  free(str);
+
+  str = OptionIndex_Str(&index_, options_, "Missing", deflt);
+  EXPECT_STREQ(deflt, str);
+  EXPECT_NE(deflt, str);
+  free(str);
+  EXPECT_EQ(NULL, OptionIndex_Str(&index_, options_, "Missing", NULL));
+
+  OptionIndex_Free(&index_);
+  str = OptionIndex_Str(&index_, options_, "Board", NULL);
+  EXPECT_STREQ("link", str);
+  free(str);
+}
+
+// The first lookup of an option logs it, like xf86Set*Option, and marks it
+// used; only the options no one looked up are reported.
+TEST_F(OptionIndexTest, LogsLookupsAndReportsUnused) {
+  InputInfoRec info;
+
+  Add("Tap Enable", "1");
+  Add("Left Handed", "0");
+  Add("_source", "server/udev");
+  Index();
+
+  EXPECT_TRUE(OptionIndex_Bool(&index_, options_, "Tap Enable", FALSE));
+  EXPECT_TRUE(OptionIndex_Bool(&index_, options_, "Tap Enable", FALSE));
+  EXPECT_STREQ("Option \"Tap Enable\" \"1\"\n", stub_log);
+
+  stub_log[0] = '\0';
+  memset(&info, 0, sizeof(info));
+  OptionIndex_Report_Unused(&index_, &info);
+  EXPECT_STREQ("Option \"Left Handed\" is not used\n", stub_log);
+}
+
+// Options set in the config are told apart from missing ones
+TEST_F(OptionIndexTest, IsSet) {
+  Add("Accel Min dt", "0.001");
+  Index();
+
+  EXPECT_TRUE(OptionIndex_Is_Set(&index_, options_, "Accel_Min_dt"));
+  EXPECT_FALSE(OptionIndex_Is_Set(&index_, options_, "Accel Max dt"));
+}
+
+// An option set to the shipped board default counts as not set, so values
+// derived at run time can replace it; the config value is still used.
+TEST_F(OptionIndexTest, IsSetIgnoresBoardDefaultValue) {
+  Add("Accel Min dt", "1e-4");
+  Add("Mouse CPI", "800");
+  Index();
+  // The generic mouse section of 20-mouse.conf
+  OptionIndex_Add_Board(&index_, NULL, BOARD_MATCH_POINTER, "Mouse", 0x046d,
+                        0xc077, "/dev/input/event3");
+
+  EXPECT_FALSE(OptionIndex_Is_Set(&index_, options_, "Accel Min dt"));
+  EXPECT_EQ(1e-4, OptionIndex_Real(&index_, options_, "Accel Min dt", 0.0));
+  EXPECT_TRUE(OptionIndex_Is_Set(&index_, options_, "Mouse CPI"));
+}
+
+TEST_F(OptionIndexTest, IsSetWithOtherValue) {
+  Add("Accel Min dt", "0.002");
+  Index();
+  OptionIndex_Add_Board(&index_, NULL, BOARD_MATCH_POINTER, "Mouse", 0x046d,
+                        0xc077, "/dev/input/event3");
+
+  EXPECT_TRUE(OptionIndex_Is_Set(&index_, options_, "Accel Min dt"));
+  EXPECT_EQ(0.002, OptionIndex_Real(&index_, options_, "Accel Min dt", 0.0));
+}
+
+// The non-linearity correction options of a board come from the board
+// table; replacing one hides the board default like a config option.
+TEST_F(OptionIndexTest, ReplaceBoolHidesBoardDefault) {
+  char* path;
+
+  Index();
+  OptionIndex_Add_Board(&index_, "lumpy", BOARD_MATCH_TOUCHPAD, "cyapa", 0, 0,
+                        "/dev/input/event3");
+
+  EXPECT_TRUE(OptionIndex_Bool(&index_, options_,
+                               "Enable non-linearity correction", FALSE));
+  path = OptionIndex_Str(&index_, options_,
+                         "Non-linearity correction data file", NULL);
+  EXPECT_STREQ("/usr/share/gestures/lumpy_linearity.dat", path);
+  free(path);
+
+  OptionIndex_Replace_Bool(&index_, &options_,
+                           "Enable non-linearity correction", FALSE);
+  EXPECT_FALSE(OptionIndex_Bool(&index_, options_,
+                                "Enable non-linearity correction", TRUE));
+  EXPECT_STREQ("off", xf86FindOptionValue(options_,
+                                          "Enable_non-linearity_correction"));
+}
+
+TEST_F(OptionIndexTest, ReplaceBoolOfConfigOption) {
+  Add("Tap Enable", "1");
+  Index();
+
+  OptionIndex_Replace_Bool(&index_, &options_, "Tap Enable", FALSE);
+  EXPECT_FALSE(OptionIndex_Bool(&index_, options_, "Tap Enable", TRUE));
+  EXPECT_EQ(NULL, xf86NextOption(options_));
+}
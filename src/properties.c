@@ -6,14 +6,20 @@
 
 #include "properties.h"
 
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
 #include <exevents.h>
 #include <inputstr.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/XI.h>
+#include <xf86_OSproc.h>
 #include <xserver-properties.h>
 
 #include "cmt.h"
 #include "cmt-properties.h"
+#include "conf.h"
 #include "gesture.h"
 
 #define COMPILE_ASSERT(expr) COMPILE_ASSERT_IMPL(expr, __LINE__)
@@ -21,6 +27,21 @@
 #define COMPILE_ASSERT_IMPL(expr, line)                                 \
     typedef char COMPILE_ASSERT_JOIN(assertion_failed_, line)[2*!!(expr) - 1];
 
+/* Report rate detection, see PropRate_Start */
+#define PROP_RATE_POLL_MS     1000
+#define PROP_MIN_DT           "Accel Min dt"
+#define PROP_MIN_DT_PERIODS   0.3    /* Of the measured frame interval */
+#define PROP_MIN_DT_LOW       0.0001 /* s */
+#define PROP_MIN_DT_HIGH      0.01   /* s */
+
+/* Adaptive queue delay, see PropQueue_Start */
+#define PROP_QUEUE_POLL_MS     500
+#define PROP_QUEUE_DELAY       "Input Queue Delay"
+#define PROP_QUEUE_LATE_FRAMES 1       /* Tolerated per poll */
+#define PROP_QUEUE_STEP        0.002   /* s added when frames were late */
+#define PROP_QUEUE_DECAY       0.25    /* Per poll, towards the target */
+#define PROP_QUEUE_RESOLUTION  0.0002  /* s, smaller changes are not set */
+
 typedef enum PropType {
     PropTypeInt,
     PropTypeShort,
@@ -29,11 +50,36 @@ typedef enum PropType {
     PropTypeReal,
 } PropType;
 
-struct GesturesProp {
-    GesturesProp* next;
+/*
+ * Name, atom and layout of a property. These are the same for every device
+ * that creates the property, so they are shared by all of them.
+ */
+typedef struct PropSchema {
+    char* name;
     Atom atom;
     PropType type;
     size_t count;
+} PropSchema;
+
+struct GesturesProp {
+    GesturesProp* next;
+    GesturesProp* prev;
+    Atom atom;  /* Same as schema->atom, kept here for lookups */
+    const PropSchema* schema;
+    BOOL read_only;
+    void* pending;  /* Initial value, until it is published */
+    BOOL set_pending;  /* Set handler held back by an open batch */
+    void* staged;      /* Value written during an open batch, not stored */
+    size_t staged_size;
+    char* string;         /* Owned copy of the stored string value */
+    char* staged_string;  /* Owned copy of the staged string value */
+    BOOL pinned;       /* Always published, even in lazy mode */
+    BOOL lazy;         /* Only in driver storage, not known to the server */
+    BOOL reloaded;     /* Already taken from the config by PropReload_Set */
+    void* published;   /* Last value sent to or received from the server */
+    size_t published_size;
+    unsigned long generation;  /* Counts writes of the stored value */
+    unsigned long published_generation;  /* The server's, 0 if unknown */
     union {
         void* v;
         int* i;
@@ -54,16 +100,48 @@ static int PropertyDel(DeviceIntPtr, Atom);
 
 /* Property List management functions */
 static GesturesProp* PropList_Find(DeviceIntPtr, Atom);
-static void PropList_Insert(DeviceIntPtr, GesturesProp*);
+static int PropList_Insert(DeviceIntPtr, GesturesProp*);
 static void PropList_Remove(DeviceIntPtr, GesturesProp*);
 static void PropList_Free(DeviceIntPtr);
+static size_t PropList_Slot(CmtDevicePtr, Atom);
+static int PropList_Grow(CmtDevicePtr);
+
+/* Property schema registry */
+static const PropSchema* PropSchema_Get(const char*, PropType, size_t);
+static void PropSchema_Flush(void);
 
 /* Property helper functions */
+static unsigned PropDeviceType(CmtDevicePtr);
+static void PropBoardDefaults(InputInfoPtr);
 static int PropChange(DeviceIntPtr, Atom, PropType, size_t, const void*);
+static int PropPublish(DeviceIntPtr, GesturesProp*);
+static size_t PropSize(PropType, size_t, const void*);
+static void PropCache(GesturesProp*, const void*, size_t);
+static void PropUncache(GesturesProp*);
+static void PropTouch(GesturesProp*);
+static void PropRefresh(DeviceIntPtr, const char*);
+static int PropDefer(GesturesProp*, PropType, size_t, const void*);
+static void PropBatch_Set(void*);
+static void PropLazy_Set(void*);
+static void PropReload_Set(void*);
+static CARD32 PropReload_Run(OsTimerPtr, CARD32, pointer);
+static void PropRate_Start(DeviceIntPtr);
+static void PropRate_Stop(DeviceIntPtr);
+static CARD32 PropRate_Poll(OsTimerPtr, CARD32, pointer);
+static void PropQueue_Start(DeviceIntPtr);
+static void PropQueue_Stop(DeviceIntPtr);
+static void PropQueue_Set(void*);
+static CARD32 PropQueue_Poll(OsTimerPtr, CARD32, pointer);
+static GesturesProp* PropList_Find_Name(DeviceIntPtr, const char*);
 static GesturesProp* PropCreate(DeviceIntPtr, const char*, PropType, void*,
                                 size_t, const void*);
 
 /* Typed PropertySet Callback Handlers */
+static int PropLock(void);
+static void PropUnlock(int);
+static Bool PropBatched(CmtDevicePtr, GesturesProp*);
+static const void* PropValue(GesturesProp*);
+static void PropStore(DeviceIntPtr, GesturesProp*, const void*, size_t);
 static int PropSet_Int(DeviceIntPtr, GesturesProp*, XIPropertyValuePtr, BOOL);
 static int PropSet_Short(DeviceIntPtr, GesturesProp*, XIPropertyValuePtr, BOOL);
 static int PropSet_Bool(DeviceIntPtr, GesturesProp*, XIPropertyValuePtr, BOOL);
@@ -100,6 +178,56 @@ GesturesPropProvider prop_provider = {
     Prop_Free
 };
 
+/*
+ * Device kind, as InputClass sections match it.
+ */
+static unsigned
+PropDeviceType(CmtDevicePtr cmt)
+{
+    switch (cmt->evdev.info.evdev_class) {
+    case EvdevClassMouse:
+    case EvdevClassMultitouchMouse:
+        return BOARD_MATCH_POINTER;
+    case EvdevClassTouchpad:
+        return BOARD_MATCH_TOUCHPAD;
+    case EvdevClassTouchscreen:
+        return BOARD_MATCH_TOUCHSCREEN;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Add the compiled in xorg-conf defaults for this device below its
+ * options. Board specific sections need Option "Board".
+ */
+static void
+PropBoardDefaults(InputInfoPtr info)
+{
+    CmtDevicePtr cmt = info->private;
+    EvdevInfo* evinfo = &cmt->evdev.info;
+    char* board;
+
+    board = OptionIndex_Str(&cmt->option_index, info->options, "Board", NULL);
+    OptionIndex_Add_Board(&cmt->option_index, board, PropDeviceType(cmt),
+                          evinfo->name, evinfo->id.vendor, evinfo->id.product,
+                          cmt->device);
+    free(board);
+}
+
+int
+PropertiesIndexOptions(InputInfoPtr info)
+{
+    CmtDevicePtr cmt = info->private;
+    int rc;
+
+    rc = OptionIndex_Init(&cmt->option_index, info->options);
+    if (rc == Success)
+        PropBoardDefaults(info);
+
+    return rc;
+}
+
 static GesturesProp*
 PropCreate_IntSingle(void* priv, const char* name, int* val, int init)
 {
@@ -116,13 +244,59 @@ PropertiesInit(DeviceIntPtr dev)
     CmtDevicePtr cmt = info->private;
     CmtPropertiesPtr props = &cmt->props;
     GesturesProp *dump_debug_log_prop;
+    GestureMetricsRingPtr metrics = cmt->gesture.metrics;
+    GesturesProp *metrics_buffer_prop;
+    GesturesProp *metrics_ack_prop;
+    GesturesProp *lean_events_prop;
+    GesturesProp *keyboard_prop;
+    GesturesProp *frame_jitter_prop;
+    GesturesProp *direct_touch_prop;
+    GesturesProp *touchscreen_gestures_prop;
+    GesturesProp *gesture_stream_prop;
+    GesturesProp *stream_location_prop;
+    GesturesProp *stream_dir_prop;
+    GesturesProp *batch_prop;
+    GesturesProp *batch_time_prop;
+    GesturesProp *lazy_prop;
+    GesturesProp *publish_lazy_prop;
+    GesturesProp *reload_prop;
+    GesturesProp *reload_changes_prop;
+    GesturesProp *report_rate_prop;
+    GesturesProp *report_jitter_prop;
+    GesturesProp *adaptive_queue_prop;
+    GesturesProp *queue_current_prop;
+    GesturesProp *queue_corrections_prop;
     GesturesPropBool bool_false = FALSE;
+    GesturesPropBool bool_true = TRUE;
+    double queue_min_delay = 0.0;
+    double queue_max_delay = 0.017;
 
     cmt->handlers = XIRegisterPropertyHandler(dev, PropertySet, PropertyGet,
                                               PropertyDel);
     if (cmt->handlers == 0)
         return BadAlloc;
 
+    /*
+     * Keep the properties of the driver and the gestures library in driver
+     * storage until DeviceInit is done, then hand them to the server in
+     * one pass.
+     */
+    cmt->prop_deferred = TRUE;
+
+    /*
+     * Every property looks up an option of the same name. Index the
+     * options once instead of scanning the list for each of them.
+     */
+    if (!cmt->option_index.size && PropertiesIndexOptions(info) != Success)
+        ERR(info, "Failed to index options\n");
+
+    /*
+     * Properties of the driver itself are always published. In lazy mode,
+     * the gestures library ones only reach the server when a client writes
+     * them or asks for all of them through "Publish Lazy Properties".
+     */
+    cmt->prop_pin = TRUE;
+
     /* Create Device Properties */
 
     /* Read Only properties */
@@ -173,13 +347,776 @@ PropertiesInit(DeviceIntPtr dev)
     Prop_RegisterHandlers(dev, dump_debug_log_prop, &cmt->evdev, NULL,
                           Event_Dump_Debug_Log);
 
-    PropCreate_Bool(dev,
-                    CMT_PROP_RAW_TOUCH_PASSTHROUGH,
-                    &props->raw_passthrough,
-                    1,
-                    &bool_false);
+    PropCreate_Bool(dev,
+                    CMT_PROP_RAW_TOUCH_PASSTHROUGH,
+                    &props->raw_passthrough,
+                    1,
+                    &bool_false);
+
+    PropCreate_Bool(dev,
+                    CMT_PROP_WARM_RESUME,
+                    &props->warm_resume,
+                    1,
+                    &bool_false);
+
+    /*
+     * Metrics gestures are buffered in the driver, read in batches through
+     * a property and dropped once the reader acknowledges them, unless the
+     * old valuator events are requested.
+     */
+    PropCreate_Bool(dev,
+                    CMT_PROP_METRICS_VALUATORS,
+                    &props->metrics_valuators,
+                    1,
+                    &bool_false);
+    metrics_buffer_prop = PropCreate_Real(dev,
+                                          CMT_PROP_METRICS_BUFFER,
+                                          metrics->buffer,
+                                          GESTURE_METRICS_BUFFER_LEN,
+                                          metrics->buffer);
+    if (metrics_buffer_prop)
+        metrics_buffer_prop->read_only = TRUE;
+    Prop_RegisterHandlers(dev, metrics_buffer_prop, &cmt->gesture,
+                          Gesture_Metrics_Get, NULL);
+    metrics->ack = 0;
+    metrics_ack_prop = PropCreate(dev, CMT_PROP_METRICS_ACK, PropTypeInt,
+                                  &metrics->ack, 1, &metrics->ack);
+    Prop_RegisterHandlers(dev, metrics_ack_prop, &cmt->gesture, NULL,
+                          Gesture_Metrics_Ack);
+
+    /*
+     * The registered axis set cannot change after DeviceInit. These report
+     * the mode in use and are not looked up in the options again.
+     */
+    lean_events_prop = PropCreate(dev, CMT_PROP_LEAN_EVENTS, PropTypeBool,
+                                  &props->lean_events, 1,
+                                  &props->lean_events);
+    if (lean_events_prop)
+        lean_events_prop->read_only = TRUE;
+    keyboard_prop = PropCreate(dev, CMT_PROP_KEYBOARD, PropTypeBool,
+                               &props->keyboard, 1, &props->keyboard);
+    if (keyboard_prop)
+        keyboard_prop->read_only = TRUE;
+    direct_touch_prop = PropCreate(dev, CMT_PROP_DIRECT_TOUCH, PropTypeBool,
+                                   &props->direct_touch, 1,
+                                   &props->direct_touch);
+    if (direct_touch_prop)
+        direct_touch_prop->read_only = TRUE;
+    if (props->direct_touch) {
+        touchscreen_gestures_prop = PropCreate(dev,
+                                               CMT_PROP_TOUCHSCREEN_GESTURES,
+                                               PropTypeBool,
+                                               &props->touchscreen_gestures,
+                                               1,
+                                               &props->touchscreen_gestures);
+        Prop_RegisterHandlers(dev, touchscreen_gestures_prop, &cmt->gesture,
+                              NULL, Gesture_Interpreter_Set);
+    }
+
+    /*
+     * Frame times from the controller's MSC_TIMESTAMP, and how much the
+     * frame intervals vary with kernel and with the times in use.
+     */
+    PropCreate_Bool(dev,
+                    CMT_PROP_HW_TIMESTAMPS,
+                    &cmt->gesture.timing.enabled,
+                    1,
+                    &bool_true);
+    frame_jitter_prop = PropCreate_Real(dev,
+                                        CMT_PROP_FRAME_JITTER,
+                                        cmt->gesture.timing.jitter,
+                                        2,
+                                        cmt->gesture.timing.jitter);
+    if (frame_jitter_prop)
+        frame_jitter_prop->read_only = TRUE;
+    Prop_RegisterHandlers(dev, frame_jitter_prop, &cmt->gesture.timing,
+                          FrameTiming_Get_Jitter, NULL);
+
+    /*
+     * Optional shared memory copy of the gesture stream, as a file in a
+     * directory the consumer can reach. The server creates the file as
+     * root, so only the config chooses the directory. Its location is
+     * empty while disabled.
+     */
+    stream_dir_prop = PropCreate_String(dev, CMT_PROP_GESTURE_STREAM_DIR,
+                                        &props->gesture_stream_dir,
+                                        "/run/cmt");
+    if (stream_dir_prop)
+        stream_dir_prop->read_only = TRUE;
+    gesture_stream_prop = PropCreate_Bool(dev,
+                                          CMT_PROP_GESTURE_STREAM,
+                                          &props->gesture_stream,
+                                          1,
+                                          &bool_false);
+    Prop_RegisterHandlers(dev, gesture_stream_prop, &cmt->gesture, NULL,
+                          Gesture_Stream_Set);
+    stream_location_prop = PropCreate(dev, CMT_PROP_GESTURE_STREAM_LOCATION,
+                                      PropTypeString,
+                                      &cmt->gesture.stream.location, 0, "");
+    if (stream_location_prop)
+        stream_location_prop->read_only = TRUE;
+    Prop_RegisterHandlers(dev, stream_location_prop, &cmt->gesture,
+                          Gesture_Stream_Get_Location, NULL);
+
+    /* Only for devices whose correction data the driver has loaded */
+    if (cmt->linearity)
+        PropCreate_Bool(dev,
+                        CMT_PROP_LINEARITY_CORRECTION,
+                        &props->linearity_correction,
+                        1,
+                        &bool_true);
+
+    /*
+     * Batched updates: while "Property Batch" is set, writes only update
+     * driver storage, and clearing it runs each affected set handler once.
+     * Always starts closed, whatever the config says.
+     */
+    props->property_batch = FALSE;
+    batch_prop = PropCreate(dev, CMT_PROP_PROPERTY_BATCH, PropTypeBool,
+                            &props->property_batch, 1,
+                            &props->property_batch);
+    Prop_RegisterHandlers(dev, batch_prop, dev, NULL, PropBatch_Set);
+    props->property_batch_time = 0.0;
+    batch_time_prop = PropCreate_Real(dev, CMT_PROP_PROPERTY_BATCH_TIME,
+                                      &props->property_batch_time, 1,
+                                      &props->property_batch_time);
+    if (batch_time_prop)
+        batch_time_prop->read_only = TRUE;
+
+    props->lazy_properties = OptionIndex_Bool(&cmt->option_index,
+                                              info->options,
+                                              CMT_PROP_LAZY_PROPERTIES,
+                                              FALSE);
+    lazy_prop = PropCreate(dev, CMT_PROP_LAZY_PROPERTIES, PropTypeBool,
+                           &props->lazy_properties, 1,
+                           &props->lazy_properties);
+    if (lazy_prop)
+        lazy_prop->read_only = TRUE;
+    props->publish_lazy = FALSE;
+    publish_lazy_prop = PropCreate(dev, CMT_PROP_PUBLISH_LAZY, PropTypeBool,
+                                   &props->publish_lazy, 1,
+                                   &props->publish_lazy);
+    Prop_RegisterHandlers(dev, publish_lazy_prop, dev, NULL, PropLazy_Set);
+
+    /*
+     * Live reload of the InputClass options that apply to this device,
+     * without reopening it.
+     */
+    PropCreate_String(dev, CMT_PROP_CONFIG_DIRS, &props->config_dirs,
+                      "/etc/X11/xorg.conf.d:/usr/share/X11/xorg.conf.d");
+    props->reload_config = FALSE;
+    reload_prop = PropCreate(dev, CMT_PROP_RELOAD_CONFIG, PropTypeBool,
+                             &props->reload_config, 1,
+                             &props->reload_config);
+    Prop_RegisterHandlers(dev, reload_prop, dev, NULL, PropReload_Set);
+    props->reload_changes = 0;
+    reload_changes_prop = PropCreate(dev, CMT_PROP_RELOAD_CHANGES,
+                                     PropTypeInt, &props->reload_changes, 1,
+                                     &props->reload_changes);
+    if (reload_changes_prop)
+        reload_changes_prop->read_only = TRUE;
+
+    /*
+     * Report rate and interval jitter, measured after the device is first
+     * enabled, and the "Accel Min dt" derived from them unless the config
+     * sets a value other than the shipped default.
+     */
+    PropCreate_Bool(dev, CMT_PROP_DETECT_RATE, &props->detect_rate, 1,
+                    &bool_true);
+    props->min_dt_set = OptionIndex_Is_Set(&cmt->option_index, info->options,
+                                           PROP_MIN_DT);
+    props->report_rate = 0.0;
+    report_rate_prop = PropCreate(dev, CMT_PROP_REPORT_RATE, PropTypeReal,
+                                  &props->report_rate, 1,
+                                  &props->report_rate);
+    if (report_rate_prop)
+        report_rate_prop->read_only = TRUE;
+    props->report_jitter = 0.0;
+    report_jitter_prop = PropCreate(dev, CMT_PROP_REPORT_JITTER, PropTypeReal,
+                                    &props->report_jitter, 1,
+                                    &props->report_jitter);
+    if (report_jitter_prop)
+        report_jitter_prop->read_only = TRUE;
+
+    /*
+     * Closed loop "Input Queue Delay", kept as short as the frame arrival
+     * jitter allows.
+     */
+    adaptive_queue_prop = PropCreate_Bool(dev, CMT_PROP_ADAPTIVE_QUEUE,
+                                          &props->adaptive_queue, 1,
+                                          &bool_false);
+    Prop_RegisterHandlers(dev, adaptive_queue_prop, dev, NULL,
+                          PropQueue_Set);
+    PropCreate_Real(dev, CMT_PROP_QUEUE_MIN_DELAY, &props->queue_min_delay,
+                    1, &queue_min_delay);
+    PropCreate_Real(dev, CMT_PROP_QUEUE_MAX_DELAY, &props->queue_max_delay,
+                    1, &queue_max_delay);
+    props->queue_delay = 0.0;
+    props->queue_delay_start = -1.0;
+    queue_current_prop = PropCreate(dev, CMT_PROP_QUEUE_CURRENT, PropTypeReal,
+                                    &props->queue_delay, 1,
+                                    &props->queue_delay);
+    if (queue_current_prop)
+        queue_current_prop->read_only = TRUE;
+    props->queue_corrections = 0;
+    queue_corrections_prop = PropCreate(dev, CMT_PROP_QUEUE_CORRECTIONS,
+                                        PropTypeInt,
+                                        &props->queue_corrections, 1,
+                                        &props->queue_corrections);
+    if (queue_corrections_prop)
+        queue_corrections_prop->read_only = TRUE;
+
+    cmt->prop_pin = FALSE;
+
+    return Success;
+}
+
+/**
+ * Publish the properties created since PropertiesInit to the server
+ */
+void
+PropertiesPublish(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    GesturesProp* prop;
+    GesturesProp* last = NULL;
+
+    cmt->prop_deferred = FALSE;
+
+    /* The list is newest first; publish in creation order */
+    for (prop = cmt->prop_list; prop; prop = prop->next)
+        last = prop;
+
+    cmt->prop_publishing = TRUE;
+    for (prop = last; prop; prop = prop->prev) {
+        if (!prop->pending)
+            continue;
+        if (cmt->props.lazy_properties && !prop->pinned && prop->val.v) {
+            /* Driver storage already holds the value */
+            free(prop->pending);
+            prop->pending = NULL;
+            prop->lazy = TRUE;
+            continue;
+        }
+        if (PropChange(dev, prop->atom, prop->schema->type, prop->schema->count,
+                       prop->pending) == Success)
+            XISetDevicePropertyDeletable(dev, prop->atom, FALSE);
+        else
+            ERR(info, "Failed to publish property \"%s\"\n",
+                NameForAtom(prop->atom));
+        free(prop->pending);
+        prop->pending = NULL;
+    }
+    cmt->prop_publishing = FALSE;
+}
+
+/*
+ * Set handler of "Property Batch". Opening a batch needs nothing more than
+ * the stored value; closing it stores every staged value at once, runs the
+ * held back set handlers in creation order and reports how long that took.
+ */
+static void
+PropBatch_Set(void* data)
+{
+    DeviceIntPtr dev = data;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    GesturesProp* prop;
+    GesturesProp* last = NULL;
+    struct timespec start, end;
+    Bool synced;
+    int state;
+
+    if (cmt->props.property_batch)
+        return;
+
+    for (prop = cmt->prop_list; prop; prop = prop->next)
+        last = prop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    state = PropLock();
+    for (prop = last; prop; prop = prop->prev) {
+        if (!prop->staged)
+            continue;
+        memcpy(prop->val.v, prop->staged, prop->staged_size);
+        free(prop->staged);
+        prop->staged = NULL;
+        if (prop->staged_string) {
+            free(prop->string);
+            prop->string = prop->staged_string;
+            prop->staged_string = NULL;
+        }
+        /* The server got the staged value with the write */
+        synced = prop->published_generation == prop->generation;
+        PropTouch(prop);
+        if (synced)
+            prop->published_generation = prop->generation;
+    }
+
+    /* Set handlers run under the lock, as from PropertySet */
+    for (prop = last; prop; prop = prop->prev) {
+        if (!prop->set_pending)
+            continue;
+        prop->set_pending = FALSE;
+        if (prop->set)
+            prop->set(prop->handler_data);
+    }
+    PropUnlock(state);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    cmt->props.property_batch_time = (end.tv_sec - start.tv_sec) * 1000.0 +
+                                     (end.tv_nsec - start.tv_nsec) / 1e6;
+    DBG(info, "Property batch applied in %.3f ms\n",
+        cmt->props.property_batch_time);
+    PropRefresh(dev, CMT_PROP_PROPERTY_BATCH_TIME);
+}
+
+/*
+ * Set handler of "Publish Lazy Properties". Publishes every lazy property
+ * with its current value, or takes the unpinned ones off the server again.
+ */
+static void
+PropLazy_Set(void* data)
+{
+    DeviceIntPtr dev = data;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    GesturesProp* prop;
+
+    if (!cmt->props.lazy_properties)
+        return;
+
+    for (prop = cmt->prop_list; prop; prop = prop->next) {
+        if (prop->pinned || !prop->val.v)
+            continue;
+        if (cmt->props.publish_lazy && prop->lazy) {
+            prop->lazy = FALSE;
+            if (PropPublish(dev, prop) == Success)
+                XISetDevicePropertyDeletable(dev, prop->atom, FALSE);
+            else
+                prop->lazy = TRUE;
+        } else if (!cmt->props.publish_lazy && !prop->lazy) {
+            prop->lazy = TRUE;
+            PropUncache(prop);
+            XIDeleteDeviceProperty(dev, prop->atom, FALSE);
+        }
+    }
+}
+
+/*
+ * Apply one option from the config to a property, through the same path
+ * as a client write. Returns TRUE if the value changed.
+ */
+static Bool
+PropReload_Apply(DeviceIntPtr dev, GesturesProp* prop, const char* str)
+{
+    const PropSchema* schema = prop->schema;
+    const void* cur = PropValue(prop);
+    union {
+        int i;
+        short h;
+        BOOL b;
+        float r;
+    } v;
+    Bool bval;
+    char* end;
+
+    if (!prop->val.v || prop->read_only || schema->count != 1)
+        return FALSE;
+
+    switch (schema->type) {
+    case PropTypeInt:
+        v.i = strtol(str, &end, 0);
+        if (end == str || *end || v.i == *(const int*)cur)
+            return FALSE;
+        break;
+    case PropTypeShort:
+        v.h = strtol(str, &end, 0);
+        if (end == str || *end || v.h == *(const short*)cur)
+            return FALSE;
+        break;
+    case PropTypeBool:
+        if (*str && !xf86getBoolValue(&bval, str))
+            return FALSE;
+        v.b = *str ? bval : TRUE;
+        if (v.b == !!*(const GesturesPropBool*)cur)
+            return FALSE;
+        break;
+    case PropTypeReal:
+        v.r = strtod(str, &end);
+        if (end == str || *end || v.r == (float)*(const double*)cur)
+            return FALSE;
+        break;
+    case PropTypeString:
+        if (*(const char* const*)cur && !strcmp(*(const char* const*)cur, str))
+            return FALSE;
+        return PropChange(dev, prop->atom, schema->type, 0, str) == Success;
+    default:
+        return FALSE;
+    }
+
+    return PropChange(dev, prop->atom, schema->type, 1, &v) == Success;
+}
+
+/*
+ * Set handler of "Reload Config". Set handlers run under the input lock,
+ * so the files are read from a timer on the main thread instead.
+ */
+static void
+PropReload_Set(void* data)
+{
+    DeviceIntPtr dev = data;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+
+    if (!props->reload_config)
+        return;
+    props->reload_config = FALSE;
+    props->reload_timer = TimerSet(props->reload_timer, 0, 1, PropReload_Run,
+                                   dev);
+}
+
+/*
+ * Timer callback, on the main thread. Reads the InputClass sections of
+ * the config directories again and writes every option of the matching
+ * ones that differs from the current value, as one property batch: the
+ * values are all stored at once when it closes. The interpreter and the
+ * device stay as they are.
+ */
+static CARD32
+PropReload_Run(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    DeviceIntPtr dev = arg;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    EvdevInfo* evinfo = &cmt->evdev.info;
+    const BoardSection* section;
+    const BoardOption* option;
+    GesturesProp* prop;
+    Bool batch_open = props->property_batch;
+    char usbid[16];
+    char* dirs;
+    char* dir;
+    char* saveptr;
+    ConfRec conf;
+    Atom atom;
+    size_t i, j;
+    int rc;
+
+    Conf_Init(&conf);
+    dirs = strdup(props->config_dirs ? props->config_dirs : "");
+    if (!dirs)
+        return 0;
+    for (dir = strtok_r(dirs, ":", &saveptr); dir;
+         dir = strtok_r(NULL, ":", &saveptr)) {
+        rc = Conf_Load_Dir(&conf, dir);
+        if (rc != Success && rc != ENOENT)
+            ERR(info, "Failed to read \"%s\": %s\n", dir, strerror(rc));
+    }
+    free(dirs);
+
+    snprintf(usbid, sizeof(usbid), "%04x:%04x", evinfo->id.vendor,
+             evinfo->id.product);
+
+    /* Later sections win, so walk backwards and take each option once */
+    for (prop = cmt->prop_list; prop; prop = prop->next)
+        prop->reloaded = FALSE;
+
+    props->property_batch = TRUE;
+    props->reload_changes = 0;
+    for (i = conf.num_sections; i-- > 0;) {
+        section = &conf.sections[i];
+        if (!OptionIndex_Section_Matches(section, NULL, PropDeviceType(cmt),
+                                         evinfo->name, usbid, cmt->device))
+            continue;
+        for (j = section->num_options; j-- > 0;) {
+            option = &section->options[j];
+            atom = MakeAtom(option->name, strlen(option->name), FALSE);
+            prop = atom != None ? PropList_Find(dev, atom) : NULL;
+            if (!prop || prop->reloaded)
+                continue;
+            prop->reloaded = TRUE;
+            if (PropReload_Apply(dev, prop, option->value)) {
+                DBG(info, "Reloaded \"%s\" = \"%s\"\n", option->name,
+                    option->value);
+                props->reload_changes++;
+            }
+        }
+    }
+    Conf_Free(&conf);
+
+    /* Run the set handlers, unless a client batch is still open */
+    props->property_batch = batch_open;
+    if (!batch_open)
+        PropBatch_Set(dev);
+
+    xf86IDrvMsg(info, X_INFO, "Reloaded config, %d properties changed\n",
+                props->reload_changes);
+    PropRefresh(dev, CMT_PROP_RELOAD_CHANGES);
+
+    return 0;
+}
+
+/**
+ * Start the report rate and queue delay measurements of an enabled device.
+ * The first time, also report the options no one used; the server has
+ * taken its own ones by now. The index stays until PropertiesClose, for
+ * the properties the gestures library creates later.
+ */
+void
+PropertiesDeviceOn(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+
+    OptionIndex_Report_Unused(&cmt->option_index, info);
+
+    PropRate_Start(dev);
+    PropQueue_Start(dev);
+}
+
+void
+PropertiesDeviceOff(DeviceIntPtr dev)
+{
+    PropRate_Stop(dev);
+    PropQueue_Stop(dev);
+}
+
+/*
+ * Measure the report rate from the frames after the device is enabled, once.
+ */
+static void
+PropRate_Start(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    GesturesProp* prop;
+
+    if (!props->detect_rate || props->report_rate > 0.0)
+        return;
+
+    /* A client writing "Accel Min dt" meanwhile keeps its value */
+    prop = PropList_Find_Name(dev, PROP_MIN_DT);
+    props->min_dt_start = prop && prop->val.r ? *prop->val.r : 0.0;
+
+    FrameTiming_Sample(&cmt->gesture.timing);
+    props->rate_timer = TimerSet(props->rate_timer, 0, PROP_RATE_POLL_MS,
+                                 PropRate_Poll, dev);
+}
+
+static void
+PropRate_Stop(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+
+    if (cmt->props.rate_timer)
+        TimerCancel(cmt->props.rate_timer);
+    cmt->gesture.timing.sampling = FALSE;
+}
+
+/*
+ * Timer callback, on the main thread. Waits for the samples, publishes the
+ * rate and sets "Accel Min dt" to a fraction of the frame interval through
+ * the same path as a client write.
+ */
+static CARD32
+PropRate_Poll(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    DeviceIntPtr dev = arg;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    GesturesProp* prop;
+    double interval, jitter, min_dt;
+    float val;
+    Bool measured;
+    int state;
+
+    state = PropLock();
+    measured = FrameTiming_Rate(&cmt->gesture.timing, &interval, &jitter);
+    PropUnlock(state);
+    if (!measured)
+        return PROP_RATE_POLL_MS;
+
+    props->report_rate = 1.0 / interval;
+    props->report_jitter = jitter * 1000.0;
+    PropRefresh(dev, CMT_PROP_REPORT_RATE);
+    PropRefresh(dev, CMT_PROP_REPORT_JITTER);
+    xf86IDrvMsg(info, X_INFO, "Report rate %.1f Hz, interval jitter %.2f ms\n",
+                props->report_rate, props->report_jitter);
+
+    prop = PropList_Find_Name(dev, PROP_MIN_DT);
+    if (!prop || !prop->val.r || prop->read_only ||
+        prop->schema->type != PropTypeReal || prop->schema->count != 1)
+        return 0;
+    if (props->min_dt_set || *prop->val.r != props->min_dt_start) {
+        DBG(info, "Keeping \"%s\" as set\n", PROP_MIN_DT);
+        return 0;
+    }
+
+    min_dt = PROP_MIN_DT_PERIODS * interval;
+    if (min_dt < PROP_MIN_DT_LOW)
+        min_dt = PROP_MIN_DT_LOW;
+    else if (min_dt > PROP_MIN_DT_HIGH)
+        min_dt = PROP_MIN_DT_HIGH;
+    val = min_dt;
+    if (PropChange(dev, prop->atom, PropTypeReal, 1, &val) == Success)
+        xf86IDrvMsg(info, X_INFO, "Set \"%s\" to %.4f s\n", PROP_MIN_DT,
+                    min_dt);
+
+    return 0;
+}
+
+/*
+ * Closed loop "Input Queue Delay": the delay steps up whenever frames
+ * arrive later than it covers, and otherwise decays towards twice the
+ * arrival jitter, within "Adaptive Queue Min Delay" and "Max Delay".
+ * Turning the mode off restores the delay it started from.
+ */
+static void
+PropQueue_Start(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    FrameTimingPtr ft = &cmt->gesture.timing;
+    GesturesProp* prop;
+    int state;
+
+    if (!props->adaptive_queue || !dev->public.on || props->queue_running)
+        return;
+    prop = PropList_Find_Name(dev, PROP_QUEUE_DELAY);
+    if (!prop || !prop->val.r)
+        return;
+
+    props->queue_running = TRUE;
+    if (props->queue_delay_start < 0.0)
+        props->queue_delay_start = *prop->val.r;
+    props->queue_delay = *prop->val.r;
+
+    state = PropLock();
+    ft->late = 0;
+    ft->late_limit = props->queue_delay;
+    ft->watch_late = TRUE;
+    PropUnlock(state);
+
+    props->queue_timer = TimerSet(props->queue_timer, 0, PROP_QUEUE_POLL_MS,
+                                  PropQueue_Poll, dev);
+}
+
+static void
+PropQueue_Stop(DeviceIntPtr dev)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+
+    if (props->queue_timer)
+        TimerCancel(props->queue_timer);
+    cmt->gesture.timing.watch_late = FALSE;
+    props->queue_running = FALSE;
+}
+
+/*
+ * Set handler of "Adaptive Input Queue Delay", run with input locked out.
+ * Writing the restored delay has to wait for the lock to be released, so
+ * it goes through a zero length timer.
+ */
+static void
+PropQueue_Set(void* data)
+{
+    DeviceIntPtr dev = data;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+
+    if (props->adaptive_queue) {
+        PropQueue_Start(dev);
+    } else if (props->queue_delay_start >= 0.0) {
+        PropQueue_Stop(dev);
+        props->queue_delay = props->queue_delay_start;
+        props->queue_delay_start = -1.0;
+        props->queue_timer = TimerSet(props->queue_timer, 0, 1,
+                                      PropQueue_Poll, dev);
+    }
+}
+
+static void
+PropQueue_Apply(DeviceIntPtr dev, GesturesProp* prop, double delay)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    float val = delay;
+
+    if (fabs(*prop->val.r - delay) < PROP_QUEUE_RESOLUTION)
+        return;
+    if (PropChange(dev, prop->atom, PropTypeReal, 1, &val) != Success)
+        ERR(info, "Failed to set \"%s\"\n", PROP_QUEUE_DELAY);
+}
+
+/*
+ * Timer callback, on the main thread.
+ */
+static CARD32
+PropQueue_Poll(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    DeviceIntPtr dev = arg;
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    CmtPropertiesPtr props = &cmt->props;
+    FrameTimingPtr ft = &cmt->gesture.timing;
+    GesturesProp* prop;
+    double delay = props->queue_delay;
+    double target;
+    double jitter;
+    int late;
+    int state;
+
+    prop = PropList_Find_Name(dev, PROP_QUEUE_DELAY);
+    if (!prop || !prop->val.r)
+        return 0;
+
+    /* Left over from PropQueue_Set: put the starting delay back */
+    if (!props->queue_running) {
+        PropQueue_Apply(dev, prop, props->queue_delay);
+        return 0;
+    }
+
+    state = PropLock();
+    late = ft->late;
+    ft->late = 0;
+    jitter = ft->kernel_stats.jitter;
+    PropUnlock(state);
 
-    return Success;
+    if (late > PROP_QUEUE_LATE_FRAMES) {
+        delay += PROP_QUEUE_STEP;
+        props->queue_corrections++;
+    } else {
+        target = 2.0 * jitter;
+        delay += PROP_QUEUE_DECAY * (target - delay);
+    }
+    if (delay > props->queue_max_delay)
+        delay = props->queue_max_delay;
+    if (delay < props->queue_min_delay)
+        delay = props->queue_min_delay;
+
+    state = PropLock();
+    ft->late_limit = delay;
+    PropUnlock(state);
+
+    if (delay != props->queue_delay)
+        DBG(info, "Queue delay %.1f ms, %d late frames\n", delay * 1000.0,
+            late);
+    props->queue_delay = delay;
+    PropQueue_Apply(dev, prop, delay);
+    PropRefresh(dev, CMT_PROP_QUEUE_CURRENT);
+    PropRefresh(dev, CMT_PROP_QUEUE_CORRECTIONS);
+
+    return PROP_QUEUE_POLL_MS;
 }
 
 /**
@@ -191,10 +1128,107 @@ PropertiesClose(DeviceIntPtr dev)
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
 
+    TimerFree(cmt->props.rate_timer);
+    cmt->props.rate_timer = NULL;
+    TimerFree(cmt->props.queue_timer);
+    cmt->props.queue_timer = NULL;
+    TimerFree(cmt->props.reload_timer);
+    cmt->props.reload_timer = NULL;
     PropList_Free(dev);
+    OptionIndex_Free(&cmt->option_index);
     XIUnregisterPropertyHandler(dev, cmt->handlers);
 }
 
+/*
+ * Input processing may run in the input thread (or the SIGIO handler on
+ * older servers) and read property storage at any time. Keep it out while
+ * a value or the configuration derived from it changes.
+ */
+static int
+PropLock(void)
+{
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 23
+    input_lock();
+    return 0;
+#else
+    return xf86BlockSIGIO();
+#endif
+}
+
+static void
+PropUnlock(int state)
+{
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 23
+    input_unlock();
+#else
+    xf86UnblockSIGIO(state);
+#endif
+}
+
+/*
+ * Whether writes to a property are held back by an open batch. The batch
+ * property itself is what closes it, so it is never held back.
+ */
+static Bool
+PropBatched(CmtDevicePtr cmt, GesturesProp* prop)
+{
+    return cmt->props.property_batch &&
+           prop->val.b != &cmt->props.property_batch;
+}
+
+/*
+ * Current value of a property, including a write an open batch holds back.
+ */
+static const void*
+PropValue(GesturesProp* prop)
+{
+    return prop->staged ? prop->staged : prop->val.v;
+}
+
+/*
+ * Replace the value of a property with a fully converted one, so input
+ * processing never sees a partly updated array. While a batch is open, the
+ * value is only staged, and PropBatch_Set stores it.
+ */
+static void
+PropStore(DeviceIntPtr dev, GesturesProp* prop, const void* value,
+          size_t size)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    void* staged;
+    int state;
+
+    if (PropBatched(cmt, prop)) {
+        staged = realloc(prop->staged, size ? size : 1);
+        if (staged) {
+            memcpy(staged, value, size);
+            prop->staged = staged;
+            prop->staged_size = size;
+            if (prop->schema->type == PropTypeString) {
+                free(prop->staged_string);
+                prop->staged_string = *(char* const*)value;
+            }
+            return;
+        }
+        /* Out of memory for the copy; store it right away instead */
+        ERR(info, "Failed to stage \"%s\"\n", NameForAtom(prop->atom));
+    }
+
+    /*
+     * Readers take the same lock, so nobody is left holding the old string
+     * once the new one is stored.
+     */
+    state = PropLock();
+    memcpy(prop->val.v, value, size);
+    if (prop->schema->type == PropTypeString) {
+        free(prop->string);
+        prop->string = *(char* const*)value;
+    }
+    PropTouch(prop);
+    PropUnlock(state);
+}
+
 /**
  * Type-Specific Device Property Set Handlers
  */
@@ -206,15 +1240,17 @@ PropSet_Int(DeviceIntPtr dev, GesturesProp* prop, XIPropertyValuePtr val,
     int i;
 
     if (val->type != XA_INTEGER || val->format != 32 ||
-        val->size != prop->count)
+        val->size != prop->schema->count)
         return BadMatch;
 
     if (!checkonly) {
-        for (i = 0; i < prop->count; i++) {
-            prop->val.i[i] = ((CARD32*)val->data)[i];
+        int staged[val->size];
+        for (i = 0; i < val->size; i++) {
+            staged[i] = ((CARD32*)val->data)[i];
             DBG(info, "\"%s\"[%d] = %d\n", NameForAtom(prop->atom), i,
-                *prop->val.i);
+                staged[i]);
         }
+        PropStore(dev, prop, staged, sizeof(staged));
     }
 
     return Success;
@@ -228,15 +1264,17 @@ PropSet_Short(DeviceIntPtr dev, GesturesProp* prop, XIPropertyValuePtr val,
     int i;
 
     if (val->type != XA_INTEGER || val->format != 16 ||
-        val->size != prop->count)
+        val->size != prop->schema->count)
         return BadMatch;
 
     if (!checkonly) {
-        for (i = 0; i < prop->count; i++) {
-            prop->val.h[i] = ((CARD16*)val->data)[i];
+        short staged[val->size];
+        for (i = 0; i < val->size; i++) {
+            staged[i] = ((CARD16*)val->data)[i];
             DBG(info, "\"%s\"[%d] = %d\n", NameForAtom(prop->atom), i,
-                *prop->val.h);
+                staged[i]);
         }
+        PropStore(dev, prop, staged, sizeof(staged));
     }
 
     return Success;
@@ -249,15 +1287,18 @@ PropSet_Bool(DeviceIntPtr dev, GesturesProp* prop, XIPropertyValuePtr val,
     InputInfoPtr info = dev->public.devicePrivate;
     int i;
 
-    if (val->type != XA_INTEGER || val->format != 8 || val->size != prop->count)
+    if (val->type != XA_INTEGER || val->format != 8 ||
+        val->size != prop->schema->count)
         return BadMatch;
 
     if (!checkonly) {
-        for (i = 0; i < prop->count; i++) {
-            prop->val.b[i] = !!(((CARD8*)val->data)[i]);
+        GesturesPropBool staged[val->size];
+        for (i = 0; i < val->size; i++) {
+            staged[i] = !!(((CARD8*)val->data)[i]);
             DBG(info, "\"%s\"[%d] = %s\n", NameForAtom(prop->atom), i,
-                *prop->val.b ? "True" : "False");
+                staged[i] ? "True" : "False");
         }
+        PropStore(dev, prop, staged, sizeof(staged));
     }
 
     return Success;
@@ -268,13 +1309,20 @@ PropSet_String(DeviceIntPtr dev, GesturesProp* prop, XIPropertyValuePtr val,
                BOOL checkonly)
 {
     InputInfoPtr info = dev->public.devicePrivate;
+    char* copy;
 
     if (val->type != XA_STRING || val->format != 8)
         return BadMatch;
 
     if (!checkonly) {
-        *prop->val.s = val->data;
-        DBG(info, "\"%s\" = \"%s\"\n", NameForAtom(prop->atom), *prop->val.s);
+        /* The server's value is not terminated and may go away */
+        copy = malloc(val->size + 1);
+        if (!copy)
+            return BadAlloc;
+        memcpy(copy, val->data, val->size);
+        copy[val->size] = '\0';
+        PropStore(dev, prop, &copy, sizeof(copy));
+        DBG(info, "\"%s\" = \"%s\"\n", NameForAtom(prop->atom), copy);
     }
 
     return Success;
@@ -288,15 +1336,18 @@ PropSet_Real(DeviceIntPtr dev, GesturesProp* prop, XIPropertyValuePtr val,
     int i;
     Atom XA_FLOAT = XIGetKnownProperty(XATOM_FLOAT);
 
-    if (val->type != XA_FLOAT || val->format != 32 || val->size != prop->count)
+    if (val->type != XA_FLOAT || val->format != 32 ||
+        val->size != prop->schema->count)
         return BadMatch;
 
     if (!checkonly) {
-        for (i = 0; i < prop->count; i++) {
-            prop->val.r[i] = ((float*)val->data)[i];
+        double staged[val->size];
+        for (i = 0; i < val->size; i++) {
+            staged[i] = ((float*)val->data)[i];
             DBG(info, "\"%s\"[%d] = %g\n", NameForAtom(prop->atom), i,
-                prop->val.r[i]);
+                staged[i]);
         }
+        PropStore(dev, prop, staged, sizeof(staged));
     }
 
     return Success;
@@ -309,17 +1360,23 @@ static int
 PropertySet(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
             BOOL checkonly)
 {
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
     GesturesProp* prop;
+    int state;
     int rc;
 
+    if (cmt->prop_publishing)
+        return Success; /* Driver storage already holds this value */
+
     prop = PropList_Find(dev, atom);
     if (!prop)
         return Success; /* Unknown or uninitialized Property */
 
-    if (prop->val.v == NULL)
+    if (prop->val.v == NULL || prop->read_only)
         return BadAccess; /* Read-only property */
 
-    switch (prop->type) {
+    switch (prop->schema->type) {
     case PropTypeInt:
         rc = PropSet_Int(dev, prop, val, checkonly);
         break;
@@ -340,8 +1397,21 @@ PropertySet(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
         break;
     }
 
-    if (!checkonly && rc == Success && prop->set)
-        prop->set(prop->handler_data);
+    /* A client writing a lazy property creates it on the server */
+    if (!checkonly && rc == Success) {
+        prop->lazy = FALSE;
+        PropCache(prop, val->data, val->size * (val->format / 8));
+    }
+
+    if (!checkonly && rc == Success && prop->set) {
+        if (PropBatched(cmt, prop)) {
+            prop->set_pending = TRUE;
+        } else {
+            state = PropLock();
+            prop->set(prop->handler_data);
+            PropUnlock(state);
+        }
+    }
 
     return rc;
 }
@@ -350,14 +1420,26 @@ static int
 PropertyGet(DeviceIntPtr dev, Atom property)
 {
     GesturesProp* prop;
+    GesturesPropBool changed;
+    int state;
 
     prop = PropList_Find(dev, property);
-    if (!prop)
+    if (!prop || !prop->get)
         return Success; /* Unknown or uninitialized Property */
 
-    // If get handler returns true, update the property value in the server.
-    if (prop->get && prop->get(prop->handler_data))
-        PropChange(dev, prop->atom, prop->type, prop->count, prop->val.v);
+    // Get handlers read state the input thread writes, so they take a
+    // snapshot under the same lock as set handlers.
+    state = PropLock();
+    changed = prop->get(prop->handler_data);
+    PropUnlock(state);
+
+    // If get handler returns true, it has written new values to storage;
+    // update the property value in the server. Values the server already
+    // holds are not sent again.
+    if (changed) {
+        PropTouch(prop);
+        PropPublish(dev, prop);
+    }
 
     return Success;
 }
@@ -365,34 +1447,121 @@ PropertyGet(DeviceIntPtr dev, Atom property)
 static int
 PropertyDel(DeviceIntPtr dev, Atom property)
 {
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    GesturesProp* prop;
+
+    /* A deleted lazy property goes back to driver storage only */
+    prop = PropList_Find(dev, property);
+    if (prop && cmt->props.lazy_properties && !prop->pinned) {
+        prop->lazy = TRUE;
+        PropUncache(prop);
+    }
+
     return Success;
 }
 
 /**
  * Property List Management
+ *
+ * Properties are kept on a doubly linked list, for ordered teardown, and in
+ * an open addressing hash table keyed by atom, for lookup. The table uses
+ * linear probing and is kept at most half full.
+ */
+
+#define PROP_INDEX_MIN_SIZE 64  /* Power of two */
+
+/*
+ * Home slot of an atom. Atoms are mostly small consecutive numbers, so they
+ * are spread with a multiplicative hash.
  */
+static size_t
+PropList_Slot(CmtDevicePtr cmt, Atom atom)
+{
+    return ((uint32_t)atom * 2654435761u) & (cmt->prop_index_size - 1);
+}
+
+static int
+PropList_Grow(CmtDevicePtr cmt)
+{
+    GesturesProp** old = cmt->prop_index;
+    size_t old_size = cmt->prop_index_size;
+    size_t size = old_size ? old_size * 2 : PROP_INDEX_MIN_SIZE;
+    size_t i, j;
+
+    cmt->prop_index = calloc(size, sizeof(*cmt->prop_index));
+    if (!cmt->prop_index) {
+        cmt->prop_index = old;
+        return BadAlloc;
+    }
+    cmt->prop_index_size = size;
+
+    for (i = 0; i < old_size; i++) {
+        if (!old[i])
+            continue;
+        for (j = PropList_Slot(cmt, old[i]->atom); cmt->prop_index[j];
+             j = (j + 1) & (size - 1))
+            continue;
+        cmt->prop_index[j] = old[i];
+    }
+    free(old);
+
+    return Success;
+}
 
 static GesturesProp*
 PropList_Find(DeviceIntPtr dev, Atom atom)
 {
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
-    GesturesProp* p;
+    size_t mask = cmt->prop_index_size - 1;
+    size_t i;
 
-    for (p = cmt->prop_list; p && p->atom != atom; p = p->next)
-        continue;
+    if (!cmt->prop_index)
+        return NULL;
 
-    return p;
+    for (i = PropList_Slot(cmt, atom); cmt->prop_index[i]; i = (i + 1) & mask)
+        if (cmt->prop_index[i]->atom == atom)
+            return cmt->prop_index[i];
+
+    return NULL;
 }
 
-static void
+/*
+ * Add a property whose atom is not indexed yet.
+ */
+static int
 PropList_Insert(DeviceIntPtr dev, GesturesProp* prop)
 {
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
+    size_t i;
+
+    if ((cmt->prop_count + 1) * 2 > cmt->prop_index_size &&
+        PropList_Grow(cmt) != Success)
+        return BadAlloc;
+
+    for (i = PropList_Slot(cmt, prop->atom); cmt->prop_index[i];
+         i = (i + 1) & (cmt->prop_index_size - 1))
+        continue;
+    cmt->prop_index[i] = prop;
+    cmt->prop_count++;
 
+    prop->prev = NULL;
     prop->next = cmt->prop_list;
+    if (cmt->prop_list)
+        cmt->prop_list->prev = prop;
     cmt->prop_list = prop;
+
+    return Success;
+}
+
+static GesturesProp*
+PropList_Find_Name(DeviceIntPtr dev, const char* name)
+{
+    Atom atom = MakeAtom(name, strlen(name), FALSE);
+
+    return atom != None ? PropList_Find(dev, atom) : NULL;
 }
 
 static void
@@ -400,21 +1569,40 @@ PropList_Remove(DeviceIntPtr dev, GesturesProp* prop)
 {
     InputInfoPtr info = dev->public.devicePrivate;
     CmtDevicePtr cmt = info->private;
-    GesturesProp* p;
+    size_t mask = cmt->prop_index_size - 1;
+    size_t i, j, home;
 
-    if (!cmt->prop_list || !prop)
+    if (!prop || !cmt->prop_index)
         return;
 
-    if (cmt->prop_list == prop) {
-        cmt->prop_list = prop->next;
+    for (i = PropList_Slot(cmt, prop->atom);
+         cmt->prop_index[i] && cmt->prop_index[i] != prop;
+         i = (i + 1) & mask)
+        continue;
+    if (!cmt->prop_index[i])
         return;
-    }
 
-    for (p = cmt->prop_list; p->next; p = p->next)
-        if (p->next == prop) {
-            p->next = p->next->next;
-            return;
+    /*
+     * Shift later entries of the probe run back into the hole, so lookups
+     * never stop early and no tombstones are needed.
+     */
+    for (j = (i + 1) & mask; cmt->prop_index[j]; j = (j + 1) & mask) {
+        home = PropList_Slot(cmt, cmt->prop_index[j]->atom);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            cmt->prop_index[i] = cmt->prop_index[j];
+            i = j;
         }
+    }
+    cmt->prop_index[i] = NULL;
+    cmt->prop_count--;
+
+    if (prop->prev)
+        prop->prev->next = prop->next;
+    else
+        cmt->prop_list = prop->next;
+    if (prop->next)
+        prop->next->prev = prop->prev;
+    prop->next = prop->prev = NULL;
 }
 
 static void
@@ -425,6 +1613,11 @@ PropList_Free(DeviceIntPtr dev)
 
     while (cmt->prop_list)
         Prop_Free(dev, cmt->prop_list);
+
+    free(cmt->prop_index);
+    cmt->prop_index = NULL;
+    cmt->prop_index_size = 0;
+    cmt->prop_count = 0;
 }
 
 static void
@@ -439,6 +1632,20 @@ Prop_Free(void* priv, GesturesProp* prop)
     DBG(info, "Freeing Property: \"%s\"\n", NameForAtom(prop->atom));
     PropList_Remove(dev, prop);
     XIDeleteDeviceProperty(dev, prop->atom, FALSE);
+
+    /*
+     * The storage outlives the property. The gestures library passes it
+     * back as the initial value when it creates the property again, so it
+     * must never point at the freed copy.
+     */
+    if (prop->string && *prop->val.s == prop->string)
+        *prop->val.s = "";
+
+    free(prop->pending);
+    free(prop->staged);
+    free(prop->staged_string);
+    free(prop->string);
+    free(prop->published);
     free(prop);
 }
 
@@ -483,6 +1690,303 @@ static int PropChange(DeviceIntPtr dev, Atom atom, PropType type, size_t count,
                                   PropModeReplace, size, val, FALSE);
 }
 
+/*
+ * Push the current driver-side value of a property to the server, unless
+ * the server already holds that value.
+ */
+static int
+PropPublish(DeviceIntPtr dev, GesturesProp* prop)
+{
+    InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    const PropSchema* schema = prop->schema;
+    float cfg[schema->type == PropTypeReal && schema->count ?
+              schema->count : 1];
+    const void* data;
+    size_t size;
+    size_t i;
+    int rc;
+
+    /* A staged value is on the server already, and the stored one is older */
+    if (!prop->val.v || prop->pending || prop->lazy || prop->staged)
+        return Success;
+
+    if (schema->type == PropTypeString) {
+        data = *prop->val.s;
+    } else if (schema->type == PropTypeReal) {
+        // Real values are stored as doubles but exported as floats
+        for (i = 0; i < schema->count; i++)
+            cfg[i] = prop->val.r[i];
+        data = cfg;
+    } else {
+        data = prop->val.v;
+    }
+    size = PropSize(schema->type, schema->count, data);
+
+    /*
+     * The driver's own properties count every write of their storage, so
+     * the generation tells whether the server is behind. The gestures
+     * library writes its storage without telling us; compare it with the
+     * last published value instead.
+     */
+    if (prop->pinned) {
+        if (prop->published_generation == prop->generation)
+            return Success;
+    } else if (prop->published && prop->published_size == size &&
+               !memcmp(prop->published, data, size)) {
+        return Success;
+    }
+
+    /*
+     * The server runs our PropertySet on this change too, which would
+     * refuse read only properties.
+     */
+    cmt->prop_publishing = TRUE;
+    rc = PropChange(dev, prop->atom, schema->type, schema->count, data);
+    cmt->prop_publishing = FALSE;
+
+    if (rc == Success)
+        PropCache(prop, data, size);
+    else
+        PropUncache(prop);
+
+    return rc;
+}
+
+/*
+ * Size in bytes of a value in the format PropChange expects. Strings are
+ * measured without their terminator.
+ */
+static size_t
+PropSize(PropType type, size_t count, const void* data)
+{
+    switch (type) {
+    case PropTypeInt:
+        return count * sizeof(int);
+    case PropTypeShort:
+        return count * sizeof(short);
+    case PropTypeBool:
+        return count * sizeof(BOOL);
+    case PropTypeString:
+        return strlen((const char*)data);
+    case PropTypeReal:
+        return count * sizeof(float);
+    default: /* Unknown type */
+        return 0;
+    }
+}
+
+/*
+ * Remember the value the server holds, so unchanged values are not sent
+ * again. For the driver's own properties, the generation is enough.
+ */
+static void
+PropCache(GesturesProp* prop, const void* data, size_t size)
+{
+    void* copy;
+
+    if (prop->pinned) {
+        prop->published_generation = prop->generation;
+        return;
+    }
+
+    copy = realloc(prop->published, size ? size : 1);
+    if (!copy) {
+        free(prop->published);
+        prop->published = NULL;
+        return;
+    }
+    memcpy(copy, data, size);
+    prop->published = copy;
+    prop->published_size = size;
+}
+
+static void
+PropUncache(GesturesProp* prop)
+{
+    free(prop->published);
+    prop->published = NULL;
+    prop->published_generation = 0;
+}
+
+/*
+ * Count a write of the stored value. Zero is left for "unknown" in
+ * published_generation.
+ */
+static void
+PropTouch(GesturesProp* prop)
+{
+    if (++prop->generation == 0)
+        prop->generation = 1;
+}
+
+/*
+ * Publish a driver property whose storage the driver has written directly,
+ * rather than through a property write.
+ */
+static void
+PropRefresh(DeviceIntPtr dev, const char* name)
+{
+    GesturesProp* prop = PropList_Find_Name(dev, name);
+
+    if (!prop)
+        return;
+    PropTouch(prop);
+    PropPublish(dev, prop);
+}
+
+/*
+ * Keep a copy of the initial value, in the format PropChange expects, for
+ * PropertiesPublish.
+ */
+static int
+PropDefer(GesturesProp* prop, PropType type, size_t count, const void* init)
+{
+    size_t size;
+    void* copy;
+
+    size = PropSize(type, count, init);
+    if (type == PropTypeString)
+        size++;
+
+    copy = malloc(size ? size : 1);
+    if (!copy)
+        return BadAlloc;
+    memcpy(copy, init, size);
+
+    free(prop->pending);
+    prop->pending = copy;
+
+    return Success;
+}
+
+/**
+ * Property Schema Registry
+ *
+ * Process wide open addressing hash table of schemas, keyed by name and
+ * probed linearly. Entries live until the server regenerates, which also
+ * resets the atom table and closes every device.
+ */
+
+#define PROP_SCHEMA_MIN_SIZE 256  /* Power of two */
+
+static struct {
+    PropSchema** table;
+    size_t size;
+    size_t used;
+    unsigned long generation;
+} prop_schema;
+
+static size_t
+PropSchema_Hash(const char* name)
+{
+    uint32_t hash = 2166136261u;  /* FNV-1a */
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void
+PropSchema_Flush(void)
+{
+    size_t i;
+
+    for (i = 0; i < prop_schema.size; i++) {
+        if (!prop_schema.table[i])
+            continue;
+        free(prop_schema.table[i]->name);
+        free(prop_schema.table[i]);
+    }
+    free(prop_schema.table);
+    prop_schema.table = NULL;
+    prop_schema.size = 0;
+    prop_schema.used = 0;
+}
+
+static int
+PropSchema_Grow(void)
+{
+    PropSchema** old = prop_schema.table;
+    size_t old_size = prop_schema.size;
+    size_t size = old_size ? old_size * 2 : PROP_SCHEMA_MIN_SIZE;
+    size_t i, j;
+
+    prop_schema.table = calloc(size, sizeof(*prop_schema.table));
+    if (!prop_schema.table) {
+        prop_schema.table = old;
+        return BadAlloc;
+    }
+    prop_schema.size = size;
+
+    for (i = 0; i < old_size; i++) {
+        if (!old[i])
+            continue;
+        for (j = PropSchema_Hash(old[i]->name) & (size - 1);
+             prop_schema.table[j]; j = (j + 1) & (size - 1))
+            continue;
+        prop_schema.table[j] = old[i];
+    }
+    free(old);
+
+    return Success;
+}
+
+/*
+ * Find the schema of a property, registering it on first use. A name
+ * created with another type or count gets an entry of its own.
+ */
+static const PropSchema*
+PropSchema_Get(const char* name, PropType type, size_t count)
+{
+    PropSchema* schema;
+    size_t mask;
+    size_t i;
+
+    if (prop_schema.generation != serverGeneration) {
+        PropSchema_Flush();
+        prop_schema.generation = serverGeneration;
+    }
+
+    mask = prop_schema.size - 1;
+    for (i = PropSchema_Hash(name) & mask;
+         prop_schema.size && prop_schema.table[i]; i = (i + 1) & mask) {
+        schema = prop_schema.table[i];
+        if (schema->type == type && schema->count == count &&
+            !strcmp(schema->name, name))
+            return schema;
+    }
+
+    if ((prop_schema.used + 1) * 2 > prop_schema.size &&
+        PropSchema_Grow() != Success)
+        return NULL;
+
+    schema = calloc(1, sizeof(*schema));
+    if (!schema)
+        return NULL;
+    schema->name = strdup(name);
+    schema->atom = MakeAtom(name, strlen(name), TRUE);
+    if (!schema->name || schema->atom == BAD_RESOURCE) {
+        free(schema->name);
+        free(schema);
+        return NULL;
+    }
+    schema->type = type;
+    schema->count = count;
+
+    mask = prop_schema.size - 1;
+    for (i = PropSchema_Hash(name) & mask; prop_schema.table[i];
+         i = (i + 1) & mask)
+        continue;
+    prop_schema.table[i] = schema;
+    prop_schema.used++;
+
+    return schema;
+}
+
 /**
  * Device Property Creators
  */
@@ -491,32 +1995,51 @@ PropCreate(DeviceIntPtr dev, const char* name, PropType type, void* val,
            size_t count, const void* init)
 {
     InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
+    const PropSchema* schema;
     GesturesProp* prop;
     Atom atom;
+    Bool deferred;
 
     DBG(info, "Creating Property: \"%s\"\n", name);
 
-    atom = MakeAtom(name, strlen(name), TRUE);
-    if (atom == BAD_RESOURCE)
-        return NULL;
-
-    if (PropChange(dev, atom, type, count, init) != Success)
+    schema = PropSchema_Get(name, type, count);
+    if (!schema)
         return NULL;
+    atom = schema->atom;
 
-    XISetDevicePropertyDeletable(dev, atom, FALSE);
+    deferred = cmt->prop_deferred;
+    if (!deferred) {
+        if (PropChange(dev, atom, type, count, init) != Success)
+            return NULL;
+        XISetDevicePropertyDeletable(dev, atom, FALSE);
+    }
 
     prop = PropList_Find(dev, atom);
     if (!prop) {
         prop = calloc(1, sizeof(*prop));
         if (!prop)
             return NULL;
-        PropList_Insert(dev, prop);
+        prop->atom = atom;
+        if (PropList_Insert(dev, prop) != Success) {
+            free(prop);
+            return NULL;
+        }
     }
 
     prop->atom = atom;
-    prop->type = type;
-    prop->count = count;
+    prop->schema = schema;
     prop->val.v = val;
+    prop->pinned = cmt->prop_pin;
+    PropTouch(prop);
+    PropUncache(prop);
+
+    if (deferred && PropDefer(prop, type, count, init) != Success) {
+        /* Out of memory for the copy; publish it right away instead */
+        if (PropChange(dev, atom, type, count, init) != Success)
+            return NULL;
+        XISetDevicePropertyDeletable(dev, atom, FALSE);
+    }
 
     return prop;
 }
@@ -527,10 +2050,12 @@ PropCreate_Int(void* priv, const char* name, int* val, size_t count,
 {
     DeviceIntPtr dev = priv;
     InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
     int cfg;
 
     if (count == 1) {
-        cfg = xf86SetIntOption(info->options, name, *init);
+        cfg = OptionIndex_Int(&cmt->option_index, info->options, name,
+                              *init);
         if (val)
             *val = cfg;
         init = &cfg;
@@ -545,10 +2070,12 @@ PropCreate_Short(void* priv, const char* name, short* val, size_t count,
 {
     DeviceIntPtr dev = priv;
     InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
     short cfg;
 
     if (count == 1) {
-        cfg = xf86SetIntOption(info->options, name, *init);
+        cfg = OptionIndex_Int(&cmt->option_index, info->options, name,
+                              *init);
         if (val)
             *val = cfg;
         init = &cfg;
@@ -563,12 +2090,14 @@ PropCreate_Bool(void* priv, const char* name, GesturesPropBool* val,
 {
     DeviceIntPtr dev = priv;
     InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
     BOOL cfg;
 
     COMPILE_ASSERT(sizeof(BOOL) == sizeof(GesturesPropBool));
 
     if (count == 1) {
-        cfg = xf86SetBoolOption(info->options, name, (BOOL)!!*init);
+        cfg = OptionIndex_Bool(&cmt->option_index, info->options, name,
+                               (BOOL)!!*init);
         if (val)
             *val = cfg;
         init = &cfg;
@@ -583,13 +2112,30 @@ PropCreate_String(void* priv, const char* name, const char** val,
 {
     DeviceIntPtr dev = priv;
     InputInfoPtr info = dev->public.devicePrivate;
-    const char* cfg;
+    CmtDevicePtr cmt = info->private;
+    GesturesProp* prop;
+    char* cfg;
 
-    cfg = xf86SetStrOption(info->options, name, init);
+    if (val)
+        *val = init;
+    cfg = OptionIndex_Str(&cmt->option_index, info->options, name, init);
+    if (!cfg && init)
+        return NULL;
     if (val)
         *val = cfg;
 
-    return PropCreate(dev, name, PropTypeString, val, 0, cfg);
+    prop = PropCreate(dev, name, PropTypeString, val, 0, cfg);
+    if (prop && val) {
+        /* Storage points at the copy; the property owns it */
+        free(prop->string);
+        prop->string = cfg;
+    } else {
+        if (val)
+            *val = init;
+        free(cfg);
+    }
+
+    return prop;
 }
 
 GesturesProp*
@@ -598,11 +2144,13 @@ PropCreate_Real(void* priv, const char* name, double* val, size_t count,
 {
     DeviceIntPtr dev = priv;
     InputInfoPtr info = dev->public.devicePrivate;
+    CmtDevicePtr cmt = info->private;
     float cfg[count];
     size_t i;
 
     if (count == 1) {
-        cfg[0] = xf86SetRealOption(info->options, name, *init);
+        cfg[0] = OptionIndex_Real(&cmt->option_index, info->options, name,
+                                  *init);
         if (val)
             *val = cfg[0];
     } else {
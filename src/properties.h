@@ -25,9 +25,51 @@ typedef struct {
     int orientation_maximum;
     int raw_passthrough;
     GesturesPropBool dump_debug_log;
+    GesturesPropBool metrics_valuators;
+    GesturesPropBool lean_events;
+    GesturesPropBool keyboard;
+    GesturesPropBool warm_resume;
+    GesturesPropBool direct_touch;
+    GesturesPropBool touchscreen_gestures;
+    GesturesPropBool gesture_stream;
+    GesturesPropBool linearity_correction;
+    GesturesPropBool property_batch;
+    GesturesPropBool lazy_properties;
+    GesturesPropBool publish_lazy;
+    GesturesPropBool reload_config;
+    int reload_changes;
+    const char* config_dirs;
+    OsTimerPtr reload_timer;
+    const char* gesture_stream_dir;
+    double property_batch_time;
+    GesturesPropBool detect_rate;
+    double report_rate;    /* Hz, 0 until measured */
+    double report_jitter;  /* ms */
+    Bool min_dt_set;       /* "Accel Min dt" is in the config */
+    double min_dt_start;   /* Its value when the measurement started */
+    OsTimerPtr rate_timer;
+    GesturesPropBool adaptive_queue;
+    double queue_min_delay;    /* s */
+    double queue_max_delay;    /* s */
+    double queue_delay;        /* s, the delay the loop has set */
+    double queue_delay_start;  /* "Input Queue Delay" before, or -1 */
+    int queue_corrections;     /* Steps up after late frames */
+    Bool queue_running;
+    OsTimerPtr queue_timer;
 } CmtProperties, *CmtPropertiesPtr;
 
+/*
+ * Index the options of a device, with the board defaults for it below
+ * them, so PreInit can look them up as the properties will. PropertiesInit
+ * indexes them itself if this was not done; PropertiesClose frees the
+ * index.
+ */
+int PropertiesIndexOptions(InputInfoPtr);
+
 int PropertiesInit(DeviceIntPtr);
+void PropertiesPublish(DeviceIntPtr);
+void PropertiesDeviceOn(DeviceIntPtr);
+void PropertiesDeviceOff(DeviceIntPtr);
 void PropertiesClose(DeviceIntPtr);
 
 extern GesturesPropProvider prop_provider;
@@ -0,0 +1,662 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#define class class_
+#define delete delete_
+#define new new_
+#define private private_
+#define public public_
+#include "cmt.h"
+#include "cmt-properties.h"
+#include "test_stubs.h"
+#undef class
+#undef delete
+#undef new
+#undef private
+#undef public
+}
+
+// A device with the driver's own properties, published like DeviceInit
+// does. The server side is the property store in test_stubs.c.
+struct TestDevice {
+  int Init(XF86OptionPtr options = NULL, const EvdevInfo* evinfo = NULL) {
+    int rc;
+
+    cmt = static_cast<CmtDevicePtr>(calloc(1, sizeof(CmtDeviceRec)));
+    memset(&info, 0, sizeof(info));
+    memset(&dev, 0, sizeof(dev));
+    info.options = options;
+    if (evinfo)
+      cmt->evdev.info = *evinfo;
+    info.private_ = cmt;
+    info.dev = &dev;
+    dev.public_.devicePrivate = &info;
+    cmt->device = const_cast<char*>("/dev/input/event0");
+    cmt->gesture.stream.location = "";
+    cmt->gesture.metrics = static_cast<GestureMetricsRingPtr>(
+        calloc(1, sizeof(GestureMetricsRingRec)));
+    rc = PropertiesInit(&dev);
+    if (rc == Success)
+      PropertiesPublish(&dev);
+    return rc;
+  }
+
+  void Close() {
+    PropertiesClose(&dev);
+    free(cmt->gesture.metrics);
+    free(cmt);
+  }
+
+  CmtDevicePtr cmt;
+  InputInfoRec info;
+  DeviceIntRec dev;
+};
+
+class PropertiesTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    stub_reset();
+    ASSERT_EQ(Success, device_.Init());
+    init_atom_calls_ = stub_make_atom_calls;
+    cmt_ = device_.cmt;
+  }
+
+  virtual void TearDown() {
+    device_.Close();
+  }
+
+  static Atom AtomFor(const char* name) {
+    return MakeAtom(name, strlen(name), TRUE);
+  }
+
+  static double Seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+  // Time of one lookup by atom with count properties on the device, and
+  // the mean number of index slots a lookup of one of them probes
+  double LookupTime(int count, double* probes);
+
+  // Mean number of index slots PropList_Find probes to reach each of the
+  // properties, walking from the home slot of its atom
+  double MeanProbes(const std::vector<Atom>& atoms,
+                    const std::vector<GesturesProp*>& props) const {
+    size_t mask = cmt_->prop_index_size - 1;
+    size_t probes = 0;
+    size_t i, j;
+
+    for (j = 0; j < props.size(); j++) {
+      i = ((uint32_t)atoms[j] * 2654435761u) & mask;
+      for (probes++; cmt_->prop_index[i] != props[j]; i = (i + 1) & mask) {
+        if (!cmt_->prop_index[i])
+          return -1.0;  // Not reachable from its home slot
+        probes++;
+      }
+    }
+    return static_cast<double>(probes) / props.size();
+  }
+
+  TestDevice device_;
+  DeviceIntRec& dev_ = device_.dev;
+  CmtDevicePtr cmt_;
+  int init_atom_calls_;  // MakeAtom calls of the first device's properties
+};
+
+static std::string TestName(int i) {
+  char name[32];
+  snprintf(name, sizeof(name), "Test Int %d", i);
+  return name;
+}
+
+// Names whose atoms all hash into the first quarter of an index of 2048
+// slots, the size it has with this many properties, so they form long
+// probe runs.
+static std::vector<std::string> CollidingNames(int count) {
+  std::vector<std::string> names;
+  std::string name;
+  Atom atom;
+  int i;
+
+  for (i = 0; (int)names.size() < count; i++) {
+    name = TestName(i);
+    atom = MakeAtom(name.c_str(), name.size(), TRUE);
+    if ((((uint32_t)atom * 2654435761u) & 2047) < 512)
+      names.push_back(name);
+  }
+  return names;
+}
+
+TEST_F(PropertiesTest, HashKeepsPropertiesAcrossDeletes) {
+  const int kCount = 600;
+  std::vector<std::string> names = CollidingNames(kCount);
+  std::vector<Atom> atoms(kCount);
+  std::vector<int> values(kCount);
+  std::vector<int> expected(kCount);
+  std::vector<GesturesProp*> props(kCount);
+  std::vector<bool> alive(kCount, true);
+  std::vector<int> order(kCount);
+  int i, j, v;
+
+  for (i = 0; i < kCount; i++) {
+    props[i] = prop_provider.create_int_fn(&dev_, names[i].c_str(),
+                                           &values[i], 1, &i);
+    ASSERT_TRUE(props[i] != NULL);
+    atoms[i] = AtomFor(names[i].c_str());
+    expected[i] = i;
+    order[i] = i;
+  }
+
+  // Delete in random order, so holes open in the middle of probe runs and
+  // later entries have to shift back over them
+  std::shuffle(order.begin(), order.end(), std::mt19937(1));
+  for (i = 0; i < kCount / 2; i++) {
+    prop_provider.free_fn(&dev_, props[order[i]]);
+    alive[order[i]] = false;
+    if (i % 20)
+      continue;
+
+    // Writes reach the properties still on the device, and only those
+    for (j = 0; j < kCount; j++) {
+      v = -1 - j;
+      EXPECT_EQ(Success, XIChangeDeviceProperty(&dev_, atoms[j], XA_INTEGER,
+                                                32, PropModeReplace, 1, &v,
+                                                FALSE));
+      if (alive[j])
+        expected[j] = v;
+      ASSERT_EQ(expected[j], values[j]) << names[j];
+    }
+  }
+
+  // Freed slots are reused by new properties
+  for (i = 0; i < kCount / 2; i++) {
+    j = order[i];
+    props[j] = prop_provider.create_int_fn(&dev_, names[j].c_str(),
+                                           &values[j], 1, &j);
+    ASSERT_TRUE(props[j] != NULL);
+  }
+  for (j = 0; j < kCount; j++) {
+    v = 2 * j;
+    EXPECT_EQ(Success, XIChangeDeviceProperty(&dev_, atoms[j], XA_INTEGER, 32,
+                                              PropModeReplace, 1, &v, FALSE));
+    EXPECT_EQ(v, values[j]) << names[j];
+  }
+}
+
+double PropertiesTest::LookupTime(int count, double* probes) {
+  const int kLookups = 200000;
+  std::vector<int> values(count);
+  std::vector<GesturesProp*> props(count);
+  std::vector<Atom> atoms(count);
+  double start;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    props[i] = prop_provider.create_int_fn(&dev_, TestName(i).c_str(),
+                                           &values[i], 1, &i);
+    atoms[i] = AtomFor(TestName(i).c_str());
+  }
+
+  // Reads of properties without a get handler are only a lookup
+  start = Seconds();
+  for (i = 0; i < kLookups; i++)
+    stub_get_property(&dev_, atoms[i % count]);
+  start = (Seconds() - start) / kLookups;
+  *probes = MeanProbes(atoms, props);
+
+  for (i = 0; i < count; i++)
+    prop_provider.free_fn(&dev_, props[i]);
+  return start;
+}
+
+// Lookups probe about as many slots with 30 or 3000 gestures library
+// properties on top of the driver's own. The times depend on the machine,
+// so they are only recorded.
+TEST_F(PropertiesTest, LookupProbesIndependentOfCount) {
+  double small_probes, large_probes;
+  double small = LookupTime(30, &small_probes);
+  double large = LookupTime(3000, &large_probes);
+
+  RecordProperty("lookup_ns_30", static_cast<int>(small * 1e9));
+  RecordProperty("lookup_ns_3000", static_cast<int>(large * 1e9));
+  EXPECT_GE(small_probes, 1.0);
+  EXPECT_LT(small_probes, 2.0);
+  EXPECT_GE(large_probes, 1.0);
+  EXPECT_LT(large_probes, 2.0);
+}
+
+// Every property name is looked up in the server's atom table once, by the
+// first device that creates it; later devices take it from the shared
+// schema.
+TEST_F(PropertiesTest, SchemasSharedBetweenDevices) {
+  TestDevice second;
+
+  stub_make_atom_calls = 0;
+  ASSERT_EQ(Success, second.Init());
+  EXPECT_EQ(cmt_->prop_count, second.cmt->prop_count);
+  EXPECT_EQ(static_cast<int>(cmt_->prop_count),
+            init_atom_calls_ - stub_make_atom_calls);
+  second.Close();
+}
+
+// Properties the gestures library creates after the device was enabled,
+// as when it builds a touchscreen's interpreter, still take their board
+// defaults. Unused options are reported once.
+TEST_F(PropertiesTest, OptionIndexKeptAfterDeviceOn) {
+  TestDevice second;
+  XF86OptionPtr options = NULL;
+  EvdevInfo evinfo;
+  const char* unused = "Option \"Test Unused\" is not used";
+  std::string log;
+  double value = 0.0;
+  const double init = 0.0;
+
+  memset(&evinfo, 0, sizeof(evinfo));
+  evinfo.evdev_class = EvdevClassTouchpad;
+  strcpy(evinfo.name, "cyapa");
+  options = stub_add_option(options, "Board", "lumpy");
+  options = stub_add_option(options, "Test Unused", "1");
+  ASSERT_EQ(Success, second.Init(options, &evinfo));
+  stub_log[0] = '\0';
+  PropertiesDeviceOn(&second.dev);
+  PropertiesDeviceOn(&second.dev);
+
+  // From the "touchpad lumpy cyapa" section
+  ASSERT_TRUE(prop_provider.create_real_fn(&second.dev, "Box Width", &value,
+                                           1, &init) != NULL);
+  EXPECT_EQ(1.0, value);
+  log = stub_log;
+  ASSERT_NE(std::string::npos, log.find(unused));
+  EXPECT_EQ(std::string::npos, log.find(unused, log.find(unused) + 1));
+
+  second.Close();
+  stub_free_options(options);
+}
+
+// A name created again with another type gets a schema of its own
+TEST_F(PropertiesTest, SchemaKeepsTypeAndCount) {
+  int int_value = 0;
+  double real_value = 0.0;
+  const int int_init = 7;
+  const double real_init = 2.5;
+  float set = 4.0;
+  GesturesProp* prop;
+
+  prop = prop_provider.create_int_fn(&dev_, "Test Value", &int_value, 1,
+                                     &int_init);
+  ASSERT_TRUE(prop != NULL);
+  prop_provider.free_fn(&dev_, prop);
+
+  prop = prop_provider.create_real_fn(&dev_, "Test Value", &real_value, 1,
+                                      &real_init);
+  ASSERT_TRUE(prop != NULL);
+  EXPECT_EQ(Success,
+            XIChangeDeviceProperty(&dev_, AtomFor("Test Value"),
+                                   XIGetKnownProperty(XATOM_FLOAT), 32,
+                                   PropModeReplace, 1, &set, FALSE));
+  EXPECT_EQ(4.0, real_value);
+  EXPECT_EQ(7, int_value);
+}
+
+struct HandlerCalls {
+  int* value;
+  int calls;
+  int last;  // Value the handler saw
+};
+
+static void CountSet(void* data) {
+  HandlerCalls* handler = static_cast<HandlerCalls*>(data);
+
+  handler->calls++;
+  handler->last = *handler->value;
+}
+
+// Writes during a batch leave driver storage alone until the batch closes,
+// then all of them are stored before the first set handler runs.
+TEST_F(PropertiesTest, BatchStagesWritesUntilClosed) {
+  int values[2] = { 1, 2 };
+  HandlerCalls handlers[2] = { { &values[0] }, { &values[1] } };
+  const char* names[2] = { "Test Batch A", "Test Batch B" };
+  BOOL batch;
+  int i, v;
+
+  for (i = 0; i < 2; i++) {
+    GesturesProp* prop = prop_provider.create_int_fn(&dev_, names[i],
+                                                     &values[i], 1,
+                                                     &values[i]);
+    ASSERT_TRUE(prop != NULL);
+    prop_provider.register_handlers_fn(&dev_, prop, &handlers[i], NULL,
+                                       CountSet);
+  }
+
+  batch = TRUE;
+  ASSERT_EQ(Success,
+            XIChangeDeviceProperty(&dev_, AtomFor(CMT_PROP_PROPERTY_BATCH),
+                                   XA_INTEGER, 8, PropModeReplace, 1, &batch,
+                                   FALSE));
+  for (i = 0; i < 2; i++) {
+    v = 10 * (i + 1);
+    EXPECT_EQ(Success, XIChangeDeviceProperty(&dev_, AtomFor(names[i]),
+                                              XA_INTEGER, 32, PropModeReplace,
+                                              1, &v, FALSE));
+    v++;
+    EXPECT_EQ(Success, XIChangeDeviceProperty(&dev_, AtomFor(names[i]),
+                                              XA_INTEGER, 32, PropModeReplace,
+                                              1, &v, FALSE));
+  }
+  EXPECT_EQ(1, values[0]);
+  EXPECT_EQ(2, values[1]);
+  EXPECT_EQ(0, handlers[0].calls);
+  EXPECT_EQ(0, handlers[1].calls);
+
+  batch = FALSE;
+  ASSERT_EQ(Success,
+            XIChangeDeviceProperty(&dev_, AtomFor(CMT_PROP_PROPERTY_BATCH),
+                                   XA_INTEGER, 8, PropModeReplace, 1, &batch,
+                                   FALSE));
+  EXPECT_EQ(11, values[0]);
+  EXPECT_EQ(21, values[1]);
+  for (i = 0; i < 2; i++) {
+    EXPECT_EQ(1, handlers[i].calls);
+    EXPECT_EQ(values[i], handlers[i].last);
+  }
+  EXPECT_EQ(0, stub_input_lock_depth);
+}
+
+// The server creates the gesture stream as root, so clients cannot choose
+// its directory
+TEST_F(PropertiesTest, GestureStreamDirectoryReadOnly) {
+  const char* dir = "/etc";
+
+  EXPECT_EQ(BadAccess,
+            XIChangeDeviceProperty(&dev_,
+                                   AtomFor(CMT_PROP_GESTURE_STREAM_DIR),
+                                   XA_STRING, 8, PropModeReplace, strlen(dir),
+                                   dir, FALSE));
+  EXPECT_STREQ("/run/cmt", cmt_->props.gesture_stream_dir);
+}
+
+// Reads of a driver property send its value to the server only after the
+// driver has written it.
+TEST_F(PropertiesTest, GetPublishesDriverPropertyOnlyWhenWritten) {
+  Atom atom = AtomFor(CMT_PROP_FRAME_JITTER);
+  FrameTimingPtr ft = &cmt_->gesture.timing;
+  unsigned long len;
+  const float* value;
+  int changes;
+
+  changes = stub_property_changes;
+  stub_get_property(&dev_, atom);
+  stub_get_property(&dev_, atom);
+  EXPECT_EQ(changes, stub_property_changes);
+
+  ft->kernel_stats.jitter = 0.002;
+  stub_get_property(&dev_, atom);
+  EXPECT_EQ(changes + 1, stub_property_changes);
+  value = static_cast<const float*>(stub_property_value(atom, &len));
+  ASSERT_TRUE(value != NULL);
+  ASSERT_EQ(2u, len);
+  EXPECT_FLOAT_EQ(2.0, value[0]);
+
+  stub_get_property(&dev_, atom);
+  EXPECT_EQ(changes + 1, stub_property_changes);
+}
+
+static GesturesPropBool AlwaysChanged(void* data) {
+  return TRUE;
+}
+
+static int get_lock_depth;
+
+static GesturesPropBool RecordLockDepth(void* data) {
+  get_lock_depth = stub_input_lock_depth;
+  return FALSE;
+}
+
+// Get handlers snapshot state the input thread writes, so they run under
+// the input lock like set handlers do.
+TEST_F(PropertiesTest, GetHandlersRunUnderInputLock) {
+  int value = 3;
+  const int init = 3;
+  GesturesProp* prop;
+
+  prop = prop_provider.create_int_fn(&dev_, "Test Locked Value", &value, 1,
+                                     &init);
+  ASSERT_TRUE(prop != NULL);
+  prop_provider.register_handlers_fn(&dev_, prop, NULL, RecordLockDepth,
+                                     NULL);
+
+  get_lock_depth = 0;
+  stub_get_property(&dev_, AtomFor("Test Locked Value"));
+  EXPECT_EQ(1, get_lock_depth);
+  EXPECT_EQ(0, stub_input_lock_depth);
+}
+
+// Gestures library handlers cannot tell whether their value changed, so an
+// unchanged value is recognized by comparing it with the published one.
+TEST_F(PropertiesTest, GetComparesLibraryPropertyWithServer) {
+  int value = 3;
+  const int init = 3;
+  GesturesProp* prop;
+  Atom atom = AtomFor("Test Library Value");
+  int changes;
+
+  prop = prop_provider.create_int_fn(&dev_, "Test Library Value", &value, 1,
+                                     &init);
+  ASSERT_TRUE(prop != NULL);
+  prop_provider.register_handlers_fn(&dev_, prop, NULL, AlwaysChanged, NULL);
+
+  changes = stub_property_changes;
+  stub_get_property(&dev_, atom);
+  stub_get_property(&dev_, atom);
+  EXPECT_GE(changes + 1, stub_property_changes);
+  changes = stub_property_changes;
+
+  value = 4;
+  stub_get_property(&dev_, atom);
+  stub_get_property(&dev_, atom);
+  EXPECT_EQ(changes + 1, stub_property_changes);
+}
+
+// Checks a string written by StringWrites: a run of one letter, whose
+// length follows from the letter.
+static bool ValidString(const char* str) {
+  size_t len, i;
+
+  if (!str || str[0] < 'a' || str[0] > 'z')
+    return false;
+  len = str[0] - 'a' + 1;
+  for (i = 1; i < len; i++)
+    if (str[i] != str[0])
+      return false;
+  return str[len] == '\0';
+}
+
+// A reader holding the input lock, like the gestures library on the input
+// thread, always sees a whole string while the main thread writes others.
+TEST_F(PropertiesTest, StringWritesSafeForLockedReaders) {
+  const int kWrites = 26 * 1000;
+  const char* value = NULL;
+  const char* init = "a";
+  Atom atom = AtomFor("Test String");
+  std::atomic<bool> done(false);
+  std::atomic<int> bad(0);
+  char buf[26];
+  int i, len;
+
+  ASSERT_TRUE(prop_provider.create_string_fn(&dev_, "Test String", &value,
+                                             init) != NULL);
+  std::thread reader([&] {
+    while (!done) {
+      input_lock();
+      if (!ValidString(value))
+        bad++;
+      input_unlock();
+    }
+  });
+
+  for (i = 0; i < kWrites; i++) {
+    // Not terminated, like the data of a client request
+    len = i % 26 + 1;
+    memset(buf, 'a' + len - 1, len);
+    ASSERT_EQ(Success, XIChangeDeviceProperty(&dev_, atom, XA_STRING, 8,
+                                              PropModeReplace, len, buf,
+                                              FALSE));
+    memset(buf, 'A', sizeof(buf));
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(0, bad);
+  EXPECT_TRUE(ValidString(value));
+  EXPECT_EQ(26u, strlen(value));
+}
+
+// The gestures library keeps its string storage when a property is freed,
+// and passes it back as the initial value when it creates the property
+// again after a server regeneration.
+TEST_F(PropertiesTest, StringStorageSurvivesFree) {
+  const char* value = NULL;
+  const char* init = "a";
+  Atom atom = AtomFor("Test String");
+  GesturesProp* prop;
+  const char* str = "abc";
+
+  prop = prop_provider.create_string_fn(&dev_, "Test String", &value, init);
+  ASSERT_TRUE(prop != NULL);
+  ASSERT_EQ(Success, XIChangeDeviceProperty(&dev_, atom, XA_STRING, 8,
+                                            PropModeReplace, strlen(str), str,
+                                            FALSE));
+  EXPECT_STREQ("abc", value);
+
+  prop_provider.free_fn(&dev_, prop);
+  ASSERT_TRUE(value != NULL);
+  EXPECT_STREQ("", value);
+
+  prop = prop_provider.create_string_fn(&dev_, "Test String", &value, value);
+  ASSERT_TRUE(prop != NULL);
+  EXPECT_STREQ("", value);
+  ASSERT_EQ(Success, XIChangeDeviceProperty(&dev_, atom, XA_STRING, 8,
+                                            PropModeReplace, 1, "b", FALSE));
+  EXPECT_STREQ("b", value);
+}
+
+// "Reload Config" reads the files from a timer on the main thread, not in
+// its set handler under the input lock, and stores what changed at once.
+TEST_F(PropertiesTest, ReloadReadsConfigFromTimer) {
+  char dir[] = "/tmp/reload_test.XXXXXX";
+  std::string path;
+  int value = 1;
+  const int init = 1;
+  BOOL reload = TRUE;
+  FILE* fp;
+
+  ASSERT_TRUE(prop_provider.create_int_fn(&dev_, "Test Reload Value", &value,
+                                          1, &init) != NULL);
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  path = std::string(dir) + "/10-test.conf";
+  fp = fopen(path.c_str(), "w");
+  ASSERT_TRUE(fp != NULL);
+  fputs("Section \"InputClass\"\n"
+        "    Identifier \"test\"\n"
+        "    Option \"Test Reload Value\" \"5\"\n"
+        "EndSection\n", fp);
+  fclose(fp);
+
+  ASSERT_EQ(Success,
+            XIChangeDeviceProperty(&dev_, AtomFor(CMT_PROP_CONFIG_DIRS),
+                                   XA_STRING, 8, PropModeReplace, strlen(dir),
+                                   dir, FALSE));
+  stub_timer_func = NULL;
+  ASSERT_EQ(Success,
+            XIChangeDeviceProperty(&dev_, AtomFor(CMT_PROP_RELOAD_CONFIG),
+                                   XA_INTEGER, 8, PropModeReplace, 1, &reload,
+                                   FALSE));
+  EXPECT_EQ(1, value);
+  ASSERT_TRUE(stub_timer_func != NULL);
+
+  EXPECT_EQ(0u, stub_timer_func(NULL, 0, stub_timer_arg));
+  EXPECT_EQ(5, value);
+  EXPECT_EQ(1, cmt_->props.reload_changes);
+  EXPECT_EQ(0, stub_input_lock_depth);
+
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+// The adaptive "Input Queue Delay" steps up after late frames, decays
+// towards twice the arrival jitter otherwise, stays within its limits, and
+// goes back to the delay it started from when turned off.
+TEST_F(PropertiesTest, AdaptiveQueueDelay) {
+  FrameTimingPtr ft = &cmt_->gesture.timing;
+  CmtPropertiesPtr props = &cmt_->props;
+  Atom adaptive = AtomFor(CMT_PROP_ADAPTIVE_QUEUE);
+  double delay = 0.0;
+  const double init = 0.010;
+  BOOL on = TRUE;
+
+  ASSERT_TRUE(prop_provider.create_real_fn(&dev_, "Input Queue Delay", &delay,
+                                           1, &init) != NULL);
+  dev_.public_.on = TRUE;
+  stub_timer_func = NULL;
+  ASSERT_EQ(Success, XIChangeDeviceProperty(&dev_, adaptive, XA_INTEGER, 8,
+                                            PropModeReplace, 1, &on, FALSE));
+  ASSERT_TRUE(stub_timer_func != NULL);
+  EXPECT_TRUE(ft->watch_late);
+  EXPECT_NEAR(init, ft->late_limit, 1e-6);
+
+  // More late frames than tolerated: one step up
+  ft->late = 3;
+  EXPECT_EQ(500u, stub_timer_func(NULL, 0, stub_timer_arg));
+  EXPECT_NEAR(0.012, delay, 1e-6);
+  EXPECT_NEAR(0.012, props->queue_delay, 1e-6);
+  EXPECT_EQ(1, props->queue_corrections);
+  EXPECT_EQ(0, ft->late);
+  EXPECT_NEAR(0.012, ft->late_limit, 1e-6);
+
+  // Then a quarter of the way towards twice the jitter
+  ft->late = 1;
+  ft->kernel_stats.jitter = 0.001;
+  stub_timer_func(NULL, 0, stub_timer_arg);
+  EXPECT_NEAR(0.0095, delay, 1e-6);
+  EXPECT_EQ(1, props->queue_corrections);
+
+  // Within the limits
+  props->queue_max_delay = 0.011;
+  for (int i = 0; i < 3; i++) {
+    ft->late = 10;
+    stub_timer_func(NULL, 0, stub_timer_arg);
+  }
+  EXPECT_NEAR(0.011, delay, 1e-6);
+  EXPECT_EQ(4, props->queue_corrections);
+  props->queue_min_delay = 0.005;
+  ft->kernel_stats.jitter = 0.0;
+  for (int i = 0; i < 20; i++)
+    stub_timer_func(NULL, 0, stub_timer_arg);
+  EXPECT_NEAR(0.005, delay, 1e-6);
+
+  // Turning it off restores the starting delay, from a timer
+  on = FALSE;
+  stub_timer_func = NULL;
+  ASSERT_EQ(Success, XIChangeDeviceProperty(&dev_, adaptive, XA_INTEGER, 8,
+                                            PropModeReplace, 1, &on, FALSE));
+  EXPECT_FALSE(ft->watch_late);
+  EXPECT_NEAR(0.005, delay, 1e-6);
+  ASSERT_TRUE(stub_timer_func != NULL);
+  EXPECT_EQ(0u, stub_timer_func(NULL, 0, stub_timer_arg));
+  EXPECT_NEAR(init, delay, 1e-6);
+  EXPECT_EQ(0, stub_input_lock_depth);
+}
@@ -2,13 +2,253 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <ctype.h>
 #include <linux/input.h>
+#include <pthread.h>
+#include <strings.h>
 
 #include <xf86.h>
 #include <xf86Xinput.h>
 
+#include "test_stubs.h"
+
 // Provide these symbols for unittests
 
+unsigned long serverGeneration = 1;
+
+StubSetProperty stub_set_property;
+StubGetProperty stub_get_property;
+int stub_make_atom_calls;
+int stub_property_changes;
+OsTimerCallback stub_timer_func;
+pointer stub_timer_arg;
+int stub_input_lock_depth;
+char stub_log[4096];
+
+// Atom n is stub_atoms[n - 1]
+static char** stub_atoms;
+static int stub_num_atoms;
+
+typedef struct {
+  Atom property;
+  Atom type;
+  int format;
+  unsigned long len;
+  void* data;
+} StubProperty;
+
+static StubProperty* stub_properties;
+static int stub_num_properties;
+
+// Options are kept as a plain list, in the order they were added
+typedef struct StubOption {
+  struct StubOption* next;
+  char* name;
+  char* value;
+  Bool used;
+} StubOption;
+
+static pthread_mutex_t stub_input_mutex;
+static pthread_once_t stub_input_once = PTHREAD_ONCE_INIT;
+static char stub_timer;
+
+void stub_reset(void) {
+  int i;
+
+  for (i = 0; i < stub_num_atoms; i++)
+    free(stub_atoms[i]);
+  free(stub_atoms);
+  stub_atoms = NULL;
+  stub_num_atoms = 0;
+  stub_make_atom_calls = 0;
+
+  for (i = 0; i < stub_num_properties; i++)
+    free(stub_properties[i].data);
+  free(stub_properties);
+  stub_properties = NULL;
+  stub_num_properties = 0;
+  stub_property_changes = 0;
+
+  stub_set_property = NULL;
+  stub_get_property = NULL;
+  stub_timer_func = NULL;
+  stub_timer_arg = NULL;
+  stub_log[0] = '\0';
+
+  // Atoms are gone, as after a server reset
+  serverGeneration++;
+}
+
+static StubProperty* stub_find_property(Atom property) {
+  int i;
+
+  for (i = 0; i < stub_num_properties; i++)
+    if (stub_properties[i].property == property)
+      return &stub_properties[i];
+  return NULL;
+}
+
+const void* stub_property_value(Atom property, unsigned long* len) {
+  StubProperty* prop = stub_find_property(property);
+
+  if (!prop)
+    return NULL;
+  if (len)
+    *len = prop->len;
+  return prop->data;
+}
+
+XF86OptionPtr stub_add_option(XF86OptionPtr list, const char* name,
+                              const char* value) {
+  StubOption* opt = calloc(1, sizeof(*opt));
+  StubOption** tail = (StubOption**)&list;
+
+  opt->name = strdup(name);
+  opt->value = value ? strdup(value) : NULL;
+  while (*tail)
+    tail = &(*tail)->next;
+  *tail = opt;
+  return list;
+}
+
+void stub_free_options(XF86OptionPtr list) {
+  StubOption* opt = (StubOption*)list;
+  StubOption* next;
+
+  for (; opt; opt = next) {
+    next = opt->next;
+    free(opt->name);
+    free(opt->value);
+    free(opt);
+  }
+}
+
+// Compare option names like the server: ignoring case, spaces and '_'
+int xf86NameCmp(const char* s1, const char* s2) {
+  for (;;) {
+    while (*s1 == ' ' || *s1 == '\t' || *s1 == '_')
+      s1++;
+    while (*s2 == ' ' || *s2 == '\t' || *s2 == '_')
+      s2++;
+    if (!*s1 || !*s2 || tolower(*s1) != tolower(*s2))
+      return tolower(*s1) - tolower(*s2);
+    s1++;
+    s2++;
+  }
+}
+
+XF86OptionPtr xf86AddNewOption(XF86OptionPtr head, const char* name,
+                               const char* val) {
+  return stub_add_option(head, name, val);
+}
+
+// Like the server, replace the value of an existing option in place
+XF86OptionPtr xf86ReplaceBoolOption(XF86OptionPtr list, const char* name,
+                                    int value) {
+  StubOption* opt = (StubOption*)xf86FindOption(list, name);
+
+  if (!opt)
+    return stub_add_option(list, name, value ? "on" : "off");
+  free(opt->value);
+  opt->value = strdup(value ? "on" : "off");
+  return list;
+}
+
+XF86OptionPtr xf86FirstOption(XF86OptionPtr list) {
+  return list;
+}
+
+XF86OptionPtr xf86NextOption(XF86OptionPtr list) {
+  return list ? (XF86OptionPtr)((StubOption*)list)->next : NULL;
+}
+
+char* xf86OptionName(XF86OptionPtr opt) {
+  return ((StubOption*)opt)->name;
+}
+
+char* xf86OptionValue(XF86OptionPtr opt) {
+  return ((StubOption*)opt)->value;
+}
+
+XF86OptionPtr xf86FindOption(XF86OptionPtr options, const char* name) {
+  StubOption* opt;
+
+  for (opt = (StubOption*)options; opt; opt = opt->next)
+    if (!xf86NameCmp(opt->name, name))
+      return (XF86OptionPtr)opt;
+  return NULL;
+}
+
+const char* xf86FindOptionValue(XF86OptionPtr options, const char* name) {
+  XF86OptionPtr opt = xf86FindOption(options, name);
+
+  return opt ? xf86OptionValue(opt) : NULL;
+}
+
+void xf86MarkOptionUsed(XF86OptionPtr option) {
+  if (option)
+    ((StubOption*)option)->used = TRUE;
+}
+
+Bool xf86CheckIfOptionUsed(XF86OptionPtr option) {
+  return ((StubOption*)option)->used;
+}
+
+Bool xf86getBoolValue(Bool* val, const char* str) {
+  if (!str)
+    return FALSE;
+  if (!*str || !strcasecmp(str, "1") || !strcasecmp(str, "on") ||
+      !strcasecmp(str, "true") || !strcasecmp(str, "yes")) {
+    *val = TRUE;
+    return TRUE;
+  }
+  if (!strcasecmp(str, "0") || !strcasecmp(str, "off") ||
+      !strcasecmp(str, "false") || !strcasecmp(str, "no")) {
+    *val = FALSE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+void LogMessageVerbSigSafe(MessageType type, int verb, const char* format,
+                           ...) {
+  return;
+}
+
+static void stub_log_append(const char* format, va_list args) {
+  size_t len = strlen(stub_log);
+
+  vsnprintf(stub_log + len, sizeof(stub_log) - len, format, args);
+}
+
+void xf86Msg(MessageType type, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  stub_log_append(format, args);
+  va_end(args);
+}
+
+// The lock is taken again by property handlers run under it
+static void stub_input_init(void) {
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&stub_input_mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void input_lock(void) {
+  pthread_once(&stub_input_once, stub_input_init);
+  pthread_mutex_lock(&stub_input_mutex);
+  stub_input_lock_depth++;
+}
+
+void input_unlock(void) {
+  stub_input_lock_depth--;
+  pthread_mutex_unlock(&stub_input_mutex);
+}
+
 int GetMotionHistorySize(void) {
   return 0;
 }
@@ -27,11 +267,25 @@ Bool InitPointerDeviceStruct(DevicePtr device,
 Atom MakeAtom(const char* string,
               unsigned len,
               Bool makeit) {
-  return 0;
+  int i;
+
+  if (makeit)
+    stub_make_atom_calls++;
+  for (i = 0; i < stub_num_atoms; i++)
+    if (strlen(stub_atoms[i]) == len && !strncmp(stub_atoms[i], string, len))
+      return i + 1;
+  if (!makeit)
+    return None;
+
+  stub_atoms = realloc(stub_atoms, (stub_num_atoms + 1) * sizeof(char*));
+  stub_atoms[stub_num_atoms] = strndup(string, len);
+  return ++stub_num_atoms;
 }
 
 const char* NameForAtom(Atom atom) {
-  return "";
+  if (atom < 1 || atom > stub_num_atoms)
+    return NULL;
+  return stub_atoms[atom - 1];
 }
 
 void TimerCancel(OsTimerPtr  pTimer) {
@@ -47,7 +301,11 @@ OsTimerPtr TimerSet(OsTimerPtr timer,
                     CARD32 millis,
                     OsTimerCallback func,
                     pointer arg) {
-  return timer;
+  if (func) {
+    stub_timer_func = func;
+    stub_timer_arg = arg;
+  }
+  return timer ? timer : (OsTimerPtr)&stub_timer;
 }
 
 void xf86AddEnabledDevice(InputInfoPtr pInfo) {
@@ -63,11 +321,17 @@ InputInfoPtr xf86AllocateInput(InputDriverPtr drv, int flags) {
 }
 
 int xf86BlockSIGIO(void) {
+  input_lock();
   return 0;
 }
 
-char* xf86CheckStrOption(pointer optlist, const char* name, char* deflt) {
-  return deflt;
+char* xf86CheckStrOption(XF86OptionPtr optlist, const char* name,
+                         char* deflt) {
+  const char* value = xf86FindOptionValue(optlist, name);
+
+  xf86MarkOptionUsed(xf86FindOption(optlist, name));
+  value = value ? value : deflt;
+  return value ? strdup(value) : NULL;
 }
 
 void xf86CollectInputOptions(InputInfoPtr pInfo,
@@ -83,15 +347,15 @@ int xf86FlushInput(int fd) {
   return 0;
 }
 
-void xf86IDrvMsg(LocalDevicePtr dev, MessageType type,
+void xf86IDrvMsg(InputInfoPtr dev, MessageType type,
                  const char* format, ...) {
   va_list args;
   va_start(args, format);
-  LogMessageVerbSigSafe(type, -1, format, args);
+  stub_log_append(format, args);
   va_end(args);
 }
 
-void xf86IDrvMsgVerb(LocalDevicePtr dev, MessageType type, int verb,
+void xf86IDrvMsgVerb(InputInfoPtr dev, MessageType type, int verb,
                      const char* format, ...) {
   va_list args;
   va_start(args, format);
@@ -99,10 +363,10 @@ void xf86IDrvMsgVerb(LocalDevicePtr dev, MessageType type, int verb,
   va_end(args);
 }
 
-void xf86InitValuatorAxisStruct(DeviceIntPtr dev, int axnum, Atom label,
+Bool xf86InitValuatorAxisStruct(DeviceIntPtr dev, int axnum, Atom label,
                                 int minval, int maxval, int resolution,
-                                int min_res, int max_res) {
-  return;
+                                int min_res, int max_res, int mode) {
+  return TRUE;
 }
 
 void xf86InitValuatorDefaults(DeviceIntPtr dev, int axnum) {
@@ -129,7 +393,7 @@ void xf86PostMotionEvent(DeviceIntPtr device, int is_absolute,
          is_absolute, first_valuator, num_valuators);
 }
 
-void xf86ProcessCommonOptions(InputInfoPtr pInfo, pointer options) {
+void xf86ProcessCommonOptions(InputInfoPtr pInfo, XF86OptionPtr options) {
   return;
 }
 
@@ -137,27 +401,43 @@ void xf86RemoveEnabledDevice(InputInfoPtr pInfo) {
   return;
 }
 
-int xf86SetBoolOption(pointer list, const char* name, int deflt) {
-  return deflt;
+int xf86SetBoolOption(XF86OptionPtr list, const char* name, int deflt) {
+  const char* value = xf86FindOptionValue(list, name);
+  Bool val;
+
+  xf86MarkOptionUsed(xf86FindOption(list, name));
+  return xf86getBoolValue(&val, value) ? val : deflt;
 }
 
-int xf86SetIntOption(pointer optlist, const char* name, int deflt) {
-  return deflt;
+int xf86SetIntOption(XF86OptionPtr optlist, const char* name, int deflt) {
+  const char* value = xf86FindOptionValue(optlist, name);
+
+  xf86MarkOptionUsed(xf86FindOption(optlist, name));
+  return value ? atoi(value) : deflt;
 }
 
-double xf86SetRealOption(pointer optlist, const char* name, double deflt) {
-  return deflt;
+double xf86SetRealOption(XF86OptionPtr optlist, const char* name,
+                         double deflt) {
+  const char* value = xf86FindOptionValue(optlist, name);
+
+  xf86MarkOptionUsed(xf86FindOption(optlist, name));
+  return value ? atof(value) : deflt;
 }
 
-char* xf86SetStrOption(pointer optlist, const char* name, char* deflt) {
-  return deflt;
+char* xf86SetStrOption(XF86OptionPtr optlist, const char* name,
+                       const char* deflt) {
+  const char* value = xf86FindOptionValue(optlist, name);
+
+  xf86MarkOptionUsed(xf86FindOption(optlist, name));
+  value = value ? value : deflt;
+  return value ? strdup(value) : NULL;
 }
 
 void xf86UnblockSIGIO(int s) {
-  return;
+  input_unlock();
 }
 
-void xf86VIDrvMsgVerb(LocalDevicePtr dev, MessageType type, int verb,
+void xf86VIDrvMsgVerb(InputInfoPtr dev, MessageType type, int verb,
                       const char* format, va_list args) {
   vprintf(format, args);
 }
@@ -168,19 +448,60 @@ int XIChangeDeviceProperty(DeviceIntPtr dev,
                            int format,
                            int mode,
                            unsigned long len,
-                           pointer value,
+                           const void* value,
                            Bool sendevent) {
+  XIPropertyValueRec val;
+  StubProperty* prop;
+  size_t size = len * (format / 8);
+  int rc;
+
+  // Handlers see the new value first, then the server keeps it
+  val.type = type;
+  val.format = format;
+  val.size = len;
+  val.data = malloc(size ? size : 1);
+  memcpy(val.data, value, size);
+  if (stub_set_property) {
+    rc = stub_set_property(dev, property, &val, TRUE);
+    if (rc == Success)
+      rc = stub_set_property(dev, property, &val, FALSE);
+    if (rc != Success) {
+      free(val.data);
+      return rc;
+    }
+  }
+
+  prop = stub_find_property(property);
+  if (!prop) {
+    stub_properties = realloc(stub_properties, (stub_num_properties + 1) *
+                                               sizeof(StubProperty));
+    prop = &stub_properties[stub_num_properties++];
+  } else {
+    free(prop->data);
+  }
+  prop->property = property;
+  prop->type = type;
+  prop->format = format;
+  prop->len = len;
+  prop->data = val.data;
+  stub_property_changes++;
   return 0;
 }
 
 int XIDeleteDeviceProperty(DeviceIntPtr device,
                            Atom property,
                            Bool fromClient) {
+  StubProperty* prop = stub_find_property(property);
+
+  if (prop) {
+    free(prop->data);
+    *prop = stub_properties[--stub_num_properties];
+  }
   return 0;
 }
 
-Atom XIGetKnownProperty(char* name) {
-  return 0;
+Atom XIGetKnownProperty(const char* name) {
+  return MakeAtom(name, strlen(name), TRUE);
 }
 
 long XIRegisterPropertyHandler(
@@ -193,7 +514,9 @@ long XIRegisterPropertyHandler(
                         Atom property),
     int (*DeleteProperty) (DeviceIntPtr dev,
                            Atom property)) {
-  return 0;
+  stub_set_property = SetProperty;
+  stub_get_property = GetProperty;
+  return 1;
 }
 
 int XISetDevicePropertyDeletable(DeviceIntPtr dev,
@@ -0,0 +1,49 @@
+// Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef _TEST_STUBS_H_
+#define _TEST_STUBS_H_
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+
+// State of the stubbed server, for unittests to drive and inspect.
+
+typedef int (*StubSetProperty)(DeviceIntPtr, Atom, XIPropertyValuePtr, BOOL);
+typedef int (*StubGetProperty)(DeviceIntPtr, Atom);
+
+// Handlers registered with XIRegisterPropertyHandler. XIChangeDeviceProperty
+// runs the set handler like the server does.
+extern StubSetProperty stub_set_property;
+extern StubGetProperty stub_get_property;
+
+// Number of MakeAtom calls allowed to create an atom
+extern int stub_make_atom_calls;
+
+// Number of values XIChangeDeviceProperty has stored
+extern int stub_property_changes;
+
+// Callback and argument of the last TimerSet with a callback
+extern OsTimerCallback stub_timer_func;
+extern pointer stub_timer_arg;
+
+// Depth of input_lock/xf86BlockSIGIO, which share one recursive mutex
+extern int stub_input_lock_depth;
+
+// Messages logged through xf86Msg and xf86IDrvMsg, as far as they fit
+extern char stub_log[4096];
+
+// Forget atoms, properties, handlers and the log, as after a server reset
+void stub_reset(void);
+
+// Value the server holds for a property, or NULL
+const void* stub_property_value(Atom property, unsigned long* len);
+
+// Append an option to the list the xf86*Option functions work on
+XF86OptionPtr stub_add_option(XF86OptionPtr list, const char* name,
+                              const char* value);
+void stub_free_options(XF86OptionPtr list);
+
+#endif
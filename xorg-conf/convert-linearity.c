@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Convert a headerless non-linearity correction file into the versioned
+ * format described in src/linearity.h, and check the result.
+ *
+ * Usage: convert-linearity in.dat out.dat
+ *
+ * Build: cc -DLINEARITY_NO_DRIVER -I../src -o convert-linearity \
+ *            convert-linearity.c ../src/linearity.c -lm
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linearity.h"
+
+static void*
+read_file(const char* path, size_t* size)
+{
+    FILE* fp = fopen(path, "rb");
+    char* data = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    size_t n;
+
+    if (!fp)
+        return NULL;
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 1 << 16;
+            data = realloc(data, cap);
+            if (!data)
+                break;
+        }
+        n = fread(data + len, 1, cap - len, fp);
+        len += n;
+    } while (n);
+    if (ferror(fp)) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    *size = len;
+
+    return data;
+}
+
+int
+main(int argc, char** argv)
+{
+    void* in;
+    void* out;
+    size_t in_size, out_size;
+    const char* why;
+    FILE* fp;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s in.dat out.dat\n", argv[0]);
+        return 2;
+    }
+
+    in = read_file(argv[1], &in_size);
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (!Linearity_Validate(in, in_size)) {
+        fprintf(stderr, "%s: already converted\n", argv[1]);
+        return 1;
+    }
+
+    why = Linearity_Convert(in, in_size, &out, &out_size);
+    if (!why)
+        why = Linearity_Validate(out, out_size);
+    if (why) {
+        fprintf(stderr, "%s: %s\n", argv[1], why);
+        return 1;
+    }
+
+    fp = fopen(argv[2], "wb");
+    if (!fp || fwrite(out, 1, out_size, fp) != out_size || fclose(fp)) {
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
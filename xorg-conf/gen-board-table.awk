@@ -0,0 +1,259 @@
+# Copyright (c) 2011 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+# Compile the InputClass sections of the xorg-conf files into the C table
+# of typed option defaults described in src/board_table.h.
+#
+# Usage: awk -f gen-board-table.awk xorg-conf/*.conf > board_table.c
+#        awk -v conf=1 -f gen-board-table.awk FILE.conf > installed.conf
+#
+# Sections from NN-touchpad-cmt-<board>.conf apply to <board> only, the
+# others to every board. Only sections of cmt devices are compiled: those
+# with Driver "cmt", or without a Driver line and not limited to
+# touchscreens, which are left to evdev. Sections with match keywords the
+# table cannot express are left out, and so are the options the server
+# itself reads.
+#
+# With conf set, one file is copied for installation without the compiled
+# options, which the driver already has. Its compiled sections from a board
+# file get Option "Board" instead, which selects them in the table.
+
+function board_of(file,    b) {
+    b = file
+    sub(/.*\//, "", b)
+    sub(/\.conf$/, "", b)
+    if (b !~ /^[0-9]+-touchpad-cmt-/)
+        return ""
+    sub(/^[0-9]+-touchpad-cmt-/, "", b)
+    return b
+}
+
+function c_lit(s) {
+    gsub(/\\/, "\\\\", s)
+    gsub(/"/, "\\\"", s)
+    return "\"" s "\""
+}
+
+# String literal, or NULL when empty
+function c_str(s) {
+    return s == "" ? "NULL" : c_lit(s)
+}
+
+function is_on(s) {
+    s = tolower(s)
+    return s == "" || s == "on" || s == "true" || s == "yes" || s == "1"
+}
+
+function is_off(s) {
+    s = tolower(s)
+    return s == "off" || s == "false" || s == "no" || s == "0"
+}
+
+# Split the quoted arguments of a line into args[1..n], return n
+function quoted(line,    n) {
+    n = 0
+    while (match(line, /"[^"]*"/)) {
+        args[++n] = substr(line, RSTART + 1, RLENGTH - 2)
+        line = substr(line, RSTART + RLENGTH)
+    }
+    return n
+}
+
+# Options read by the server rather than the driver
+function server_option(name) {
+    name = tolower(name)
+    gsub(/[ \t_]/, "", name)
+    return name ~ /^(accel(eration)?(profile|scheme|numerator|denominator))$/ ||
+           name ~ /^(accelerationthreshold|accelspeed|xkb.*|ignore|floating)$/ ||
+           name ~ /^(sendcoreevents|corepointer|corekeyboard)$/ ||
+           name ~ /^(transformationmatrix|device|driver)$/
+}
+
+function reset_section() {
+    in_section = 1
+    identifier = ""
+    driver = ""
+    match_type = ""
+    match_not_type = ""
+    match_product = ""
+    match_usbid = ""
+    match_path = ""
+    unknown_match = 0
+    num_opts = 0
+    num_lines = 0
+}
+
+# Whether the current section goes into the table
+function compiled(    i) {
+    if (unknown_match)
+        return 0
+    if (driver == "" && match_type ~ /TOUCHSCREEN/)
+        return 0
+    if (driver != "" && driver != "cmt")
+        return 0
+    for (i = 1; i <= num_opts; i++)
+        if (!server_option(opt_name[i]))
+            return 1
+    return 0
+}
+
+function add_flag(flags, flag) {
+    return flags == "" ? flag : flags " | " flag
+}
+
+# A MatchIs* line: the device must be of the kind, or with a false value
+# must not be
+function match_is(flag, value) {
+    if (is_on(value))
+        match_type = add_flag(match_type, flag)
+    else if (is_off(value))
+        match_not_type = add_flag(match_not_type, flag)
+    else
+        unknown_match = 1
+}
+
+function emit_section(    i, n, v, type, number) {
+    if (!compiled())
+        return
+    printf "static const BoardOption section_%d_options[] = {\n", num_sections
+    n = 0
+    for (i = 1; i <= num_opts; i++) {
+        if (server_option(opt_name[i]))
+            continue
+        n++
+        v = opt_value[i]
+        if (tolower(v) ~ /^(on|true|yes)$/) {
+            type = "BOARD_VALUE_BOOL"; number = "1"
+        } else if (tolower(v) ~ /^(off|false|no)$/) {
+            type = "BOARD_VALUE_BOOL"; number = "0"
+        } else if (v ~ /^[-+]?[0-9]+$/) {
+            type = "BOARD_VALUE_INT"; number = v + 0
+        } else if (v ~ real_re) {
+            type = "BOARD_VALUE_REAL"; number = v
+        } else {
+            type = "BOARD_VALUE_STRING"; number = "0"
+        }
+        printf "    { %s, %s, %s, %s },\n", c_lit(opt_name[i]), c_lit(v), \
+               type, number
+    }
+    printf "};\n\n"
+    sections[num_sections] = sprintf("    { %s, %s, %s, %s,\n" \
+        "      %s, %s, %s,\n      section_%d_options, %d },", \
+        c_lit(board), c_str(identifier), \
+        match_type == "" ? "0" : match_type, \
+        match_not_type == "" ? "0" : match_not_type, c_str(match_product), \
+        c_str(match_usbid), c_str(match_path), num_sections, n)
+    num_sections++
+}
+
+# Copy the current section without its compiled options, and without the
+# comments and blank lines that went with them
+function copy_section(    i, keep) {
+    keep = compiled()
+    for (i = 1; i <= num_lines; i++) {
+        if (keep && line_opt[i] && !server_option(opt_name[line_opt[i]]))
+            continue
+        if (keep && lines[i] ~ /^[ \t]*(#.*)?$/)
+            continue
+        if (keep && board != "" && i == num_lines)
+            printf "    Option          \"Board\" \"%s\"\n", board
+        print lines[i]
+    }
+}
+
+BEGIN {
+    real_re = "^[-+]?([0-9]+\\.?[0-9]*|\\.[0-9]+)([eE][-+]?[0-9]+)?$"
+    num_sections = 0
+    in_section = 0
+    if (!conf) {
+        print "/* Generated by xorg-conf/gen-board-table.awk. Do not edit. */"
+        print ""
+        print "#include \"board_table.h\""
+        print ""
+    }
+}
+
+FNR == 1 {
+    board = board_of(FILENAME)
+    if (conf) {
+        print "# Options of the cmt sections below are built into the driver."
+        print "# Generated from xorg-conf/" substr(FILENAME, \
+              match(FILENAME, /[^\/]*$/)) "."
+    }
+}
+
+conf && !in_section {
+    print
+}
+
+conf && in_section {
+    lines[++num_lines] = $0
+    line_opt[num_lines] = 0
+}
+
+{
+    line = $0
+    sub(/^[ \t]+/, "", line)
+    if (line == "" || line ~ /^#/)
+        next
+    keyword = line
+    sub(/[ \t].*/, "", keyword)
+    n = quoted(line)
+}
+
+keyword == "Section" && n >= 1 && args[1] == "InputClass" {
+    reset_section()
+    next
+}
+
+!in_section {
+    next
+}
+
+keyword == "EndSection" {
+    if (conf)
+        copy_section()
+    else
+        emit_section()
+    in_section = 0
+    next
+}
+
+keyword == "Identifier" && n >= 1 { identifier = args[1] }
+keyword == "Driver" && n >= 1 { driver = args[1] }
+keyword == "MatchIsTouchpad" && n >= 1 {
+    match_is("BOARD_MATCH_TOUCHPAD", args[1])
+    next
+}
+keyword == "MatchIsTouchscreen" && n >= 1 {
+    match_is("BOARD_MATCH_TOUCHSCREEN", args[1])
+    next
+}
+keyword == "MatchIsPointer" && n >= 1 {
+    match_is("BOARD_MATCH_POINTER", args[1])
+    next
+}
+keyword == "MatchProduct" && n >= 1 { match_product = args[1]; next }
+keyword == "MatchUSBID" && n >= 1 { match_usbid = args[1]; next }
+keyword == "MatchDevicePath" && n >= 1 { match_path = args[1]; next }
+keyword ~ /^(No)?Match/ { unknown_match = 1 }
+keyword == "Option" && n >= 1 {
+    num_opts++
+    opt_name[num_opts] = args[1]
+    opt_value[num_opts] = n >= 2 ? args[2] : ""
+    if (conf)
+        line_opt[num_lines] = num_opts
+}
+
+END {
+    if (conf)
+        exit
+    print "const BoardSection board_sections[] = {"
+    for (i = 0; i < num_sections; i++)
+        print sections[i]
+    print "};"
+    print ""
+    print "const size_t board_num_sections ="
+    print "    sizeof(board_sections) / sizeof(board_sections[0]);"
+}